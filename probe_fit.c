@@ -0,0 +1,177 @@
+/*
+
+  probe_fit.c - least squares fitting of probed points
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if PROBE_PROTECT_ENABLE == 1
+
+#include <math.h>
+#include <string.h>
+
+#include "probe_fit.h"
+
+#define RAD_TO_DEG 57.29577951308232
+
+void probe_fit_init (probe_fit_t *fit, probe_fit_type_t type)
+{
+    memset(fit, 0, sizeof(probe_fit_t));
+    fit->type = type;
+}
+
+void probe_fit_add (probe_fit_t *fit, float x, float y, float z)
+{
+    double dx, dy, dz, r;
+
+    if(fit->n++ == 0) {
+        fit->x0 = x;
+        fit->y0 = y;
+        fit->z0 = z;
+    }
+
+    dx = (double)x - fit->x0;
+    dy = (double)y - fit->y0;
+    dz = (double)z - fit->z0;
+
+    fit->sx += dx;
+    fit->sy += dy;
+    fit->sz += dz;
+    fit->sxx += dx * dx;
+    fit->syy += dy * dy;
+    fit->szz += dz * dz;
+    fit->sxy += dx * dy;
+    fit->sxz += dx * dz;
+    fit->syz += dy * dz;
+
+    if(fit->type == ProbeFit_Circle) {
+        r = dx * dx + dy * dy;
+        fit->sr += r;
+        fit->sxr += dx * r;
+        fit->syr += dy * r;
+        fit->srr += r * r;
+    }
+}
+
+static double det3 (double m[3][3])
+{
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+            m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+             m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+// Solves the symmetric normal equations [sxx sxy sx; sxy syy sy; sx sy n] * x = b by Cramer's rule.
+static bool solve_normal (probe_fit_t *fit, double b[3], double x[3])
+{
+    uint_fast8_t col, row;
+    double m[3][3] = {
+        { fit->sxx, fit->sxy, fit->sx },
+        { fit->sxy, fit->syy, fit->sy },
+        { fit->sx,  fit->sy,  (double)fit->n }
+    }, mc[3][3], det, scale;
+
+    det = det3(m);
+    scale = (fit->sxx + fit->syy) * (fit->sxx + fit->syy) * (double)fit->n;
+
+    // points on a line (or coincident) give a singular matrix. The determinant relative to scale is about
+    // (width / length)^2 of the point cloud, points less than 1e-4 of their extent off a line are rejected:
+    // that is within the float resolution of coordinates far from the origin and gives a meaningless fit.
+    if(scale == 0.0 || fabs(det) < scale * 1e-8)
+        return false;
+
+    for(col = 0; col < 3; col++) {
+        memcpy(mc, m, sizeof(m));
+        for(row = 0; row < 3; row++)
+            mc[row][col] = b[row];
+        x[col] = det3(mc) / det;
+    }
+
+    return true;
+}
+
+bool probe_fit_solve (probe_fit_t *fit, probe_fit_result_t *result)
+{
+    bool ok = false;
+    double b[3], x[3], n = (double)fit->n;
+
+    memset(result, 0, sizeof(probe_fit_result_t));
+    result->type = fit->type;
+    result->n = fit->n;
+
+    switch(fit->type) {
+
+        case ProbeFit_Circle:
+            b[0] = -fit->sxr;
+            b[1] = -fit->syr;
+            b[2] = -fit->sr;
+            if(fit->n >= 3 && (ok = solve_normal(fit, b, x))) {
+                double r2 = (x[0] * x[0] + x[1] * x[1]) / 4.0 - x[2];
+                if((ok = r2 > 0.0)) {
+                    // algebraic residual r + D * x + E * y + F = d^2 - R^2 ~ 2 * R * (d - R), squares summed expanded from the sums.
+                    double ssr = fit->srr + x[0] * x[0] * fit->sxx + x[1] * x[1] * fit->syy + x[2] * x[2] * n +
+                                  2.0 * (x[0] * fit->sxr + x[1] * fit->syr + x[2] * fit->sr +
+                                          x[0] * x[1] * fit->sxy + x[0] * x[2] * fit->sx + x[1] * x[2] * fit->sy);
+                    result->value[0] = (float)(fit->x0 - x[0] / 2.0);
+                    result->value[1] = (float)(fit->y0 - x[1] / 2.0);
+                    result->value[2] = (float)sqrt(r2);
+                    result->rms = ssr > 0.0 ? (float)(sqrt(ssr / n) / (2.0 * sqrt(r2))) : 0.0f;
+                }
+            }
+            break;
+
+        case ProbeFit_Plane:
+            b[0] = fit->sxz;
+            b[1] = fit->syz;
+            b[2] = fit->sz;
+            if(fit->n >= 3 && (ok = solve_normal(fit, b, x))) {
+                // residual sum of squares expanded from the sums, relative coordinates.
+                double ssr = fit->szz - 2.0 * (x[0] * fit->sxz + x[1] * fit->syz + x[2] * fit->sz) +
+                              x[0] * x[0] * fit->sxx + x[1] * x[1] * fit->syy + x[2] * x[2] * n +
+                               2.0 * (x[0] * x[1] * fit->sxy + x[0] * x[2] * fit->sx + x[1] * x[2] * fit->sy);
+                result->value[0] = (float)x[0];
+                result->value[1] = (float)x[1];
+                result->value[2] = (float)(fit->z0 + x[2] - x[0] * fit->x0 - x[1] * fit->y0);
+                result->rms = ssr > 0.0 ? (float)sqrt(ssr / n) : 0.0f;
+            }
+            break;
+
+        case ProbeFit_Line:
+            if((ok = fit->n >= 2)) {
+                double mx = fit->sx / n, my = fit->sy / n,
+                       cxx = fit->sxx / n - mx * mx, cyy = fit->syy / n - my * my, cxy = fit->sxy / n - mx * my,
+                       lmin = (cxx + cyy) / 2.0 - sqrt((cxx - cyy) * (cxx - cyy) / 4.0 + cxy * cxy);
+                if((ok = cxx + cyy > 0.0)) {
+                    result->value[0] = (float)(fit->x0 + mx);
+                    result->value[1] = (float)(fit->y0 + my);
+                    result->value[2] = (float)(atan2(2.0 * cxy, cxx - cyy) / 2.0 * RAD_TO_DEG);
+                    result->rms = lmin > 0.0 ? (float)sqrt(lmin) : 0.0f;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return ok;
+}
+
+#endif // PROBE_PROTECT_ENABLE
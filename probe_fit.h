@@ -0,0 +1,68 @@
+/*
+
+  probe_fit.h - least squares fitting of probed points
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Points are accumulated as running sums so a fit can be updated as each point arrives,
+  memory use is fixed and independent of the number of points. Sums are kept relative to the
+  first point added and in double precision to limit cancellation when points are far from the origin.
+
+    Circle: algebraic (Kasa) fit of x^2 + y^2 + D * x + E * y + F = 0 in the XY plane, >= 3 points.
+            The radial rms is derived from the algebraic residual, accurate while residuals are small relative to the radius.
+    Plane:  z = a * x + b * y + c, >= 3 points not on a line.
+    Line:   total least squares fit in the XY plane, >= 2 points.
+
+  Do not include any grblHAL headers here.
+
+*/
+
+#ifndef _PROBE_FIT_H_
+#define _PROBE_FIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    ProbeFit_None = 0,
+    ProbeFit_Circle,
+    ProbeFit_Plane,
+    ProbeFit_Line
+} probe_fit_type_t;
+
+typedef struct {
+    probe_fit_type_t type;
+    uint32_t n;
+    double x0, y0, z0;  // first point, sums are relative to it
+    double sx, sy, sz;
+    double sxx, syy, szz, sxy, sxz, syz;
+    double sr, sxr, syr, srr; // circle, r = x^2 + y^2
+} probe_fit_t;
+
+typedef struct {
+    probe_fit_type_t type;
+    uint32_t n;
+    float value[3]; // circle: x, y, radius - plane: a, b, c - line: x, y of centroid, angle in degrees from X axis
+    float rms;      // rms residual: radial for the circle, z for the plane and normal distance for the line
+} probe_fit_result_t;
+
+void probe_fit_init (probe_fit_t *fit, probe_fit_type_t type);
+void probe_fit_add (probe_fit_t *fit, float x, float y, float z);
+bool probe_fit_solve (probe_fit_t *fit, probe_fit_result_t *result);
+
+#endif
@@ -27,6 +27,33 @@
 
   M401   - Set probe connected.
   M402   - Clear probe Connected.
+  M403   - Update work offset from next probe cycle: M403 [P<1-6>] [I<x>] [J<y>] [K<z>] [R<tip radius>]
+           P selects G54-G59 (default current), I, J and K are the values to assign to the contacted surface (default 0 for the probed axes).
+  M404   - Scanning mode: M404 P1 starts, M404 P0 ends. Probe make and break positions are streamed as [SCAN:x,y,z,s|...] while moving.
+  M405   - Tag next probe cycle with a point id: M405 P<id>. If the point has been probed before in the current work coordinate system
+           the cycle starts with an approach to the standoff distance before the remembered contact position.
+  M406   - Probing feed rate tuner: M406 I|J|K<distance> Q<max feed rate> [E<start feed rate>] [L<repeats>] [S1]
+           Probes from the current position at increasing feed rates and reports the fastest feed rate meeting the tolerance,
+           S1 stores it as the tool change probing feed rate.
+  M407   - Tool diameter and runout: M407 D<nominal diameter> [K<depth>] [P0]
+           Touches both X sides of the toolsetter at G59.3 at spindle orientations 0 and 180 degrees (M19),
+           P0 measures at the current orientation only. The effective diameter is stored in the tool table.
+  M408   - Forget tool measurement: M408 [P<tool>], the next tool change measures the tool in full. All tools if P is omitted.
+  M409   - Per tool probing parameters: M409 P<tool> [D<seek rate>] [E<feed rate>] [R<pulloff rate>] [K<expected length>] [Q<tolerance>]
+           Overrides the tool change probing rates when the tool is measured, the program is held if the measured length is off by more than Q.
+           M409 P<tool> without other words clears the entry.
+  M410   - Fit probed points: M410 P1 (circle), P2 (plane) or P3 (line) starts collecting the trigger points of the following probe cycles,
+           M410 reports the fit as [FIT:<type>,<values>,<rms>,<points>] and stops collecting.
+  M411   - Grid probe: M411 I<x length> J<y length> P<columns> Q<rows> K<depth> [E<feed rate>]
+           Probes a grid starting at the current position and reports the best fit plane, flatness and tilt as [GRID:a,b,c,flatness,tilt,points].
+  M412   - Adaptive heightmap: M412 I<x length> J<y length> P<columns> Q<rows> K<depth> R<tolerance> [L<levels>] [E<feed rate>]
+           Probes a coarse grid, then subdivides cells where the probed center deviates more than R from the interpolated height.
+           Points are streamed as [HMAP:x,y,z] followed by [HMAPEND:points,full grid points].
+  M413   - Point list: M413 I<x> J<y> adds a point, M413 K<depth> [E<feed rate>] probes the points in travel optimised order,
+           M413 clears the list. Points are reported as [PNT:index,x,y,z] followed by [PNTEND:points,travel,travel in list order].
+  M414   - Point file: M414 K<depth> [P<file number>] [E<feed rate>]
+           Probes the X,Y points in /probe_points<P>.txt in file order, results are written to /probe_results<P>.txt as x,y,z
+           and a summary is reported as [PNTFILE:points,min z,max z].
 
   NOTES: The symbol TOOLSETTER_RADIUS (defined in grbl/config.h, default 5.0mm) is the tolerance for checking "@ G59.3".
          When $341 tool change mode 1 or 2 is active it is possible to jog to/from the G59.3 position.
@@ -43,14 +70,176 @@
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 
 #include "probe_plugin.h"
+#include "probe_trace.h"
+#include "probe_fit.h"
 
+#ifndef RELAY_DEBOUNCE
 #define RELAY_DEBOUNCE 50 // ms - increase if relay is slow and/or bouncy
+#endif
 
 #define PROBE_PLUGIN_PORT_SETTING1 Setting_UserDefined_7
 #define PROBE_PLUGIN_PORT_SETTING2 Setting_UserDefined_8
 #define PROBE_PLUGIN_FIXTURE_INVERT_LIMIT_SETTING Setting_UserDefined_9
+#define PROBE_PLUGIN_OPTIONS_SETTING Setting_UserDefined_6
+#define PROBE_PLUGIN_TIP_RADIUS_SETTING Setting_UserDefined_5
+#define PROBE_PLUGIN_STANDOFF_SETTING Setting_UserDefined_4
+#define PROBE_PLUGIN_OVERTRAVEL_SETTING Setting_UserDefined_3
+#define PROBE_PLUGIN_LATENCY_SETTING Setting_UserDefined_2
+#define PROBE_PLUGIN_TUNE_TOLERANCE_SETTING Setting_UserDefined_1
+#define PROBE_PLUGIN_SETTER_DIAMETER_SETTING Setting_UserDefined_0
+
+#ifndef PROBE_POINT_CACHE_SIZE
+#define PROBE_POINT_CACHE_SIZE 16 // number of remembered contact positions for M405 tagged probe cycles
+#endif
+
+#ifndef PROBE_MACROS_ENABLE
+#define PROBE_MACROS_ENABLE SDCARD_ENABLE
+#endif
+
+#define PROBE_CONNECT_MACRO     "/probe_connect.nc"
+#define PROBE_DISCONNECT_MACRO  "/probe_disconnect.nc"
+
+#ifndef PROBE_POINT_FILE_ENABLE
+#define PROBE_POINT_FILE_ENABLE SDCARD_ENABLE // M414 point list streamed from a file
+#endif
+
+#ifndef PROBE_POINT_FILE_BUFFER
+#define PROBE_POINT_FILE_BUFFER 128 // read-ahead buffer, longest line accepted
+#endif
+
+#define PROBE_POINT_FILE_IN     "/probe_points%u.txt"
+#define PROBE_POINT_FILE_OUT    "/probe_results%u.txt"
+
+#if PROBE_MACROS_ENABLE || PROBE_POINT_FILE_ENABLE
+#ifdef ARDUINO
+#include "../../grbl/vfs.h"
+#else
+#include "grbl/vfs.h"
+#endif
+#endif
+
+#if PROBE_MACROS_ENABLE
+#ifndef PROBE_MACRO_SIZE
+#define PROBE_MACRO_SIZE 256 // max size of each macro, macros are cached in RAM
+#endif
+#endif
+
+#ifndef PROBE_TUNE_ENABLE
+#define PROBE_TUNE_ENABLE 1 // M406 probing feed rate tuner
+#endif
+
+#ifndef PROBE_DIAMETER_ENABLE
+#define PROBE_DIAMETER_ENABLE 1 // M407 tool diameter and runout measurement on the toolsetter
+#endif
+
+#ifndef PROBE_TOOL_CHECK_ENABLE
+#define PROBE_TOOL_CHECK_ENABLE 1 // quick check instead of full measurement of tools already measured since power up or reset
+#endif
+
+#ifndef PROBE_TOOL_PARAMS_ENABLE
+#define PROBE_TOOL_PARAMS_ENABLE 1 // per tool probing parameters set by M409, stored in NVS
+#endif
+
+#ifndef PROBE_FIT_ENABLE
+#define PROBE_FIT_ENABLE 1 // M410 circle, plane and line fitting of probed points
+#endif
+
+#ifndef PROBE_GRID_ENABLE
+#define PROBE_GRID_ENABLE PROBE_FIT_ENABLE // M411 grid probing with plane fit and flatness
+#endif
+
+#ifndef PROBE_GRID_CANDIDATES
+#define PROBE_GRID_CANDIDATES 16 // points kept as candidates for max deviation from the plane
+#endif
+
+#ifndef PROBE_HEIGHTMAP_ENABLE
+#define PROBE_HEIGHTMAP_ENABLE PROBE_GRID_ENABLE // M412 adaptive heightmap probing
+#endif
+
+#ifndef PROBE_HEIGHTMAP_NODES
+#define PROBE_HEIGHTMAP_NODES 100 // max coarse grid points, heights are kept in RAM
+#endif
+
+#ifndef PROBE_HEIGHTMAP_LEVELS
+#define PROBE_HEIGHTMAP_LEVELS 4 // max number of times a coarse cell can be subdivided
+#endif
+
+#ifndef PROBE_HEIGHTMAP_CACHE
+#define PROBE_HEIGHTMAP_CACHE 16 // recently probed refinement points, avoids probing shared edge midpoints twice
+#endif
+
+#ifndef PROBE_POINT_LIST_SIZE
+#define PROBE_POINT_LIST_SIZE 64 // M413 point list probed in travel optimised order, 0 to disable, max 255
+#endif
+
+#if PROBE_GRID_ENABLE || PROBE_HEIGHTMAP_ENABLE || PROBE_POINT_LIST_SIZE || PROBE_POINT_FILE_ENABLE
+#define PROBE_POINTS_ENABLE 1
+#else
+#define PROBE_POINTS_ENABLE 0
+#endif
+
+#ifndef PROBE_POINT_LIST_PASSES
+#define PROBE_POINT_LIST_PASSES 8 // max number of 2-opt passes when ordering the M413 point list
+#endif
+
+#ifndef PROBE_TOOLS
+#if N_TOOLS
+#define PROBE_TOOLS N_TOOLS
+#else
+#define PROBE_TOOLS 16 // highest tool number with per tool data kept in RAM
+#endif
+#endif
+
+#define PROBE_LINE_SIZE 80 // max length of lines generated for the line runner
+
+#ifndef PROBE_PROTECT_DEBUG
+#define PROBE_PROTECT_DEBUG 0 // set to 1 to verify hook chains on every transition and collect per pulse hook statistics
+#endif
+
+#ifndef PROBE_TRACE_SIZE
+#define PROBE_TRACE_SIZE 64 // number of probe_trace_rec_t records kept in RAM, set to 0 to disable tracing
+#endif
+
+#if NGC_EXPRESSIONS_ENABLE
+
+#ifdef ARDUINO
+#include "../../grbl/ngc_params.h"
+#else
+#include "grbl/ngc_params.h"
+#endif
+
+#ifndef PROBE_HISTORY_SIZE
+#define PROBE_HISTORY_SIZE 8 // number of probe results kept as numbered parameters, set to 0 to disable
+#endif
+#ifndef PROBE_HISTORY_PARAM_BASE
+#define PROBE_HISTORY_PARAM_BASE 4000 // result n (0 = latest) is at #<base + n * 10>, see probe_history_add()
+#endif
+#ifndef PROBE_FIT_PARAM_BASE
+#define PROBE_FIT_PARAM_BASE 4090 // M410 fit result, see fit_report()
+#endif
+#define PROBE_FIT_PARAMS 7 // values, rms and points plus flatness and tilt from M411
+
+#if PROBE_HISTORY_SIZE && (PROBE_FIT_ENABLE || PROBE_GRID_ENABLE) && \
+     PROBE_FIT_PARAM_BASE < PROBE_HISTORY_PARAM_BASE + PROBE_HISTORY_SIZE * 10 && PROBE_FIT_PARAM_BASE + PROBE_FIT_PARAMS > PROBE_HISTORY_PARAM_BASE
+#error "Probe plugin: PROBE_FIT_PARAM_BASE parameters overlap the PROBE_HISTORY_SIZE result parameters"
+#endif
+
+#else
+#undef PROBE_HISTORY_SIZE
+#define PROBE_HISTORY_SIZE 0
+#endif
+
+#ifndef PROBE_SCAN_SIZE
+#define PROBE_SCAN_SIZE 64 // scan point buffer size, set to 0 to disable scanning
+#endif
+#define PROBE_SCAN_BATCH 4 // points per [SCAN:] line
+
+#if PROBE_PROTECT_DEBUG && !defined(PROBE_DEBUG_TICKS)
+#define PROBE_DEBUG_TICKS() (hal.get_micros ? hal.get_micros() : 0) // override with a cycle counter if the MCU has one, e.g. DWT->CYCCNT
+#endif
 
 
 
@@ -86,12 +275,68 @@ typedef union {
     };
 } probe_connected_flags_t;
 
+#define PROBE_CONNECTED_TOGGLE  bit(0)
+#define PROBE_CONNECTED_MCODE   bit(1)
+#define PROBE_CONNECTED_EXT_PIN bit(2)
+#define PROBE_CONNECTED_T99     bit(3)
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t
+        connect_macro    :1,
+        disconnect_macro :1,
+        keep_mcode       :1,
+        tool_check       :1,
+        reserved         :4;
+    };
+} probe_plugin_options_t;
+
+#define PROBE_SETTINGS_VERSION 1 // extended settings layout, increment when changed
+
+// The original settings up to flags are kept in their own NVS block so existing port and flag settings
+// survive upgrades, settings added later are stored from version on in a separate block.
 typedef struct {
     uint8_t protect_port;
     uint8_t tool_port;
     probe_protect_flags_t flags;
+    uint8_t version;
+    probe_plugin_options_t options;
+    bool mcode_connected; // last M401/M402 state, kept over power cycles if enabled
+    float tip_radius;
+    float approach_standoff;
+    float overtravel;   // allowable stylus overtravel in mm, 0 disables feed rate limiting
+    float latency;      // trigger to deceleration start latency in ms
+    float tune_tolerance;
+    float setter_diameter;
 } probe_protect_settings_t;
 
+typedef struct {
+    float start[N_AXIS];
+    float target[N_AXIS];
+} probe_cycle_t;
+
+// Pending work offset update armed by M403, applied when the next probe cycle succeeds.
+typedef struct {
+    bool armed;
+    coord_system_id_t id;
+    float radius;
+    axes_signals_t axes;
+    float value[N_AXIS];
+} probe_zero_t;
+
+#if PROBE_TUNE_ENABLE || PROBE_DIAMETER_ENABLE || PROBE_POINTS_ENABLE
+
+// Modal state changed by the lines of a runner job, restored when the job ends.
+typedef struct {
+    bool imperial;
+    bool incremental;
+    motion_mode_t motion;
+    float feed_rate;    // mm/min
+} probe_modal_t;
+
+#endif
+
 static probe_state_t probe = {
     .connected = On
 };
@@ -100,12 +345,16 @@ static tool_data_t *current_tool;
 
 static uint8_t probe_connect_port;
 static uint8_t tool_probe_port;
+static bool ext_pin_ok = false;
 static bool nvs_invert_probe_pin = false;
-static probe_connected_flags_t probe_connected;
+static volatile uint_fast16_t probe_connected = 0; // probe_connected_flags_t bits, only to be updated via connected_set().
 static driver_reset_ptr driver_reset;
 static user_mcode_ptrs_t user_mcode;
 
-static nvs_address_t nvs_address;
+#define PROBE_SETTINGS_BASE_SIZE offsetof(probe_protect_settings_t, version)
+#define PROBE_SETTINGS_EXT_SIZE (sizeof(probe_protect_settings_t) - PROBE_SETTINGS_BASE_SIZE)
+
+static nvs_address_t nvs_address, nvs_ext_address = 0;
 static on_report_options_ptr on_report_options;
 static probe_connected_toggle_ptr probe_connected_toggle;
 static probe_protect_settings_t probe_protect_settings;
@@ -114,18 +363,520 @@ static on_probe_completed_ptr on_probe_completed;
 static on_probe_fixture_ptr on_probe_fixture;
 static on_spindle_select_ptr on_spindle_select;
 static stepper_pulse_start_ptr stepper_pulse_start;
+static volatile bool protection_armed = false;
+static volatile bool protection_tripped = false;
+static bool pulse_hooked = false;
 static spindle_set_state_ptr on_spindle_set_state = NULL;
 static on_tool_selected_ptr on_tool_selected = NULL;
+#if PROBE_TOOL_PARAMS_ENABLE
+static on_tool_changed_ptr on_tool_changed = NULL;
+#endif
+static on_execute_realtime_ptr on_execute_realtime;
 static probe_get_state_ptr probe_get_state = NULL;
+static probe_trace_id_t probe_id = ProbeTraceId_Probe;
+static probe_cycle_t probe_cycle;
+static bool overtravel_limit_reported = false; // cleared when settings are changed and on reset
+static probe_zero_t probe_zero = {0};
+
+#if PROBE_FIT_ENABLE
+static probe_fit_t fit = { .type = ProbeFit_None }; // accumulates probe cycles started after M410 P<type>
+#endif
+
+#if PROBE_POINTS_ENABLE
+
+#define PROBE_POINTS_FEED 100.0f // mm/min, default probing feed rate
+
+typedef bool (*probe_points_next_ptr)(float *xy);         // sets the next point as machine position, false when done
+typedef void (*probe_points_sample_ptr)(float *position); // trigger position in work coordinates and program units
+
+typedef struct {
+    const char *name;
+    bool approach;       // points are on a continuous surface, see points_approach()
+    bool (*start)(void); // optional, the job is not started if false is returned
+    probe_points_next_ptr next;
+    probe_points_sample_ptr sample;
+    void (*end)(bool completed);
+} probe_points_job_t;
+
+// Probes a sequence of XY points supplied by a job: rapid to the point at the start height,
+// probe down, back off until the probe releases and retract to the start height. Used by M411 - M414.
+static struct {
+    const probe_points_job_t *job;
+    bool active;
+    bool sample;        // next probe cycle is a point
+    probe_modal_t modal; // modal state to restore
+    bool done;
+    bool contacted;     // contact_z is valid
+    uint_fast8_t line;  // line of the current point
+    float start[N_AXIS]; // machine position
+    float xy[2];        // point being probed, machine position
+    float depth;
+    float descent;      // approach distance below the start height for the current point
+    float approach_feed_rate;
+    float feed_rate;
+    float contact_z;    // last contact, machine position
+} points = {0};
+
+#endif
+
+#if PROBE_GRID_ENABLE
+
+typedef struct {
+    float x, y, z;
+} grid_point_t;
+
+// Grid probe started by M411. The plane is fitted from running sums, points are not stored. Flatness is
+// evaluated at the end from a small set of candidate points that deviated most from the plane fitted so far,
+// and the lowest and highest of the points that came while no plane could be fitted yet, e.g. along the first row.
+static struct {
+    uint_fast16_t columns;
+    uint_fast16_t rows;
+    uint_fast32_t point; // next point
+    float step[2];      // X and Y spacing, mm
+    probe_fit_t plane;
+    uint_fast8_t n_candidates;
+    grid_point_t candidate[PROBE_GRID_CANDIDATES];
+    bool unsolved;      // low and high are valid
+    grid_point_t low;
+    grid_point_t high;
+} grid = {0};
+
+#endif
+
+#if PROBE_HEIGHTMAP_ENABLE
+
+#define PROBE_HEIGHTMAP_STACK (1 + 3 * PROBE_HEIGHTMAP_LEVELS) // depth first, a split replaces one cell by four
+
+// Heights are kept as a 3 x 3 array row by row from the lower left corner: corners 0, 2, 6 and 8,
+// edge midpoints 1, 3, 5 and 7 and the center 4.
+typedef struct {
+    float x, y;         // lower left corner, machine position
+    float width;
+    float height;
+    float z[9];
+    uint_fast8_t level;
+    uint_fast8_t stage; // 0: center pending, 1-4: edge midpoints pending, 5: split
+} hmap_cell_t;
+
+typedef struct {
+    float x, y;         // machine position
+    float z;
+} hmap_point_t;
+
+// Adaptive heightmap started by M412. Coarse grid heights are kept, refinement is depth first one coarse cell at a time.
+static struct {
+    uint_fast8_t levels;
+    uint_fast8_t level_max;
+    uint_fast16_t columns;
+    uint_fast16_t rows;
+    uint_fast16_t node; // next coarse grid point
+    uint_fast16_t cell; // next coarse cell to refine
+    uint32_t points;
+    float step[2];      // X and Y spacing, mm
+    float tolerance;    // program units
+    uint_fast8_t n_cells;
+    hmap_cell_t cells[PROBE_HEIGHTMAP_STACK];
+    uint_fast8_t n_cached;
+    uint_fast8_t cache_head;
+    hmap_point_t cache[PROBE_HEIGHTMAP_CACHE];
+    float z[PROBE_HEIGHTMAP_NODES]; // coarse grid heights, program units
+} hmap = {0};
+
+#endif
+
+#if PROBE_POINT_FILE_ENABLE
+
+// Point file for M414, one X,Y point per line in work coordinates. Read through a small buffer
+// that is refilled while the retract from the previous point is executing.
+static struct {
+    uint8_t file_no;
+    bool error;
+    bool eof;
+    vfs_file_t *in;
+    vfs_file_t *out;
+    uint32_t line;
+    uint32_t points;
+    float scale;        // program units to mm
+    float offset[2];    // work to machine position, mm
+    float z_min;
+    float z_max;
+    size_t head;        // next character to parse
+    size_t tail;        // end of buffered data
+    char buffer[PROBE_POINT_FILE_BUFFER + 1];
+} point_file = {0};
+
+#endif
+
+#if PROBE_POINT_LIST_SIZE
+
+// Point list for M413, probed in travel optimised order.
+static struct {
+    uint_fast8_t n_points;
+    uint_fast8_t next;  // next point in probing order
+    float xy[PROBE_POINT_LIST_SIZE][2]; // machine position
+    uint8_t order[PROBE_POINT_LIST_SIZE];
+    float travel;       // XY travel in probing order and in the order added, mm
+    float travel_added;
+} point_list = {0};
+
+#endif
+
+#if PROBE_POINT_CACHE_SIZE
+
+// Contact positions of M405 tagged probe cycles, keyed by work coordinate system and point id.
+typedef struct {
+    bool valid;
+    coord_system_id_t wcs;
+    uint16_t point_id;
+    float contact[N_AXIS];
+} probe_point_t;
+
+static struct {
+    bool tagged;
+    uint16_t point_id;
+    uint_fast8_t next;
+    probe_point_t point[PROBE_POINT_CACHE_SIZE];
+} point_cache = {0};
+
+#endif
+
+#if PROBE_TUNE_ENABLE
+
+#define PROBE_TUNE_START_FEED 20.0f // mm/min
+
+typedef enum {
+    TuneStep_Probe = 0,
+    TuneStep_Release,   // probe away from the surface at the start feed rate until contact is lost
+    TuneStep_Retract    // rapid back to the start point
+} tune_step_t;
+
+// Feed rate sweep started by M406. Each step probes from the start point repeats times at the same feed rate,
+// the sweep ends at the first feed rate where the spread of the trigger positions exceeds the tolerance
+// or the overtravel after trigger exceeds the Probe Stylus Overtravel setting.
+static struct {
+    bool active;
+    tune_step_t step;   // next line to generate
+    bool done;
+    bool store;
+    probe_modal_t modal; // modal state to restore
+    uint_fast8_t axis;
+    uint_fast8_t repeats;
+    uint_fast8_t count;
+    float start;        // machine position along axis
+    float distance;
+    float start_feed_rate;
+    float feed_rate;
+    float max_feed_rate;
+    float best_feed_rate;
+    float min;
+    float max;
+    float overtravel;
+} tune = {0};
+
+#endif
+
+#if PROBE_DIAMETER_ENABLE || PROBE_TOOL_CHECK_ENABLE
+
+// Per tool measurement results, kept in RAM and indexed by tool number.
+typedef struct {
+    bool measured;  // length measured on the toolsetter since power up or reset
+    float contact;  // machine Z position of the toolsetter contact at the last length measurement
+    float diameter; // effective cutting diameter, measured diameter plus runout
+    float runout;   // total indicated runout across the X axis
+} probe_tool_t;
+
+static probe_tool_t tools[PROBE_TOOLS + 1] = {0};
+
+#endif
+
+#if PROBE_TOOL_CHECK_ENABLE
+
+#define PROBE_TOOL_CHECK_TOLERANCE 0.5f // mm, max length change accepted for a measured tool
+#define PROBE_TOOL_CHECK_STANDOFF 5.0f  // mm, used if the Probe Approach Standoff setting is 0
+
+static tool_data_t *fixture_tool = NULL; // tool being measured in a tool change sequence
+
+#endif
+
+#if PROBE_TOOL_PARAMS_ENABLE
+
+// Per tool probing parameters, 0 selects the tool change setting. Kept compact as the table is stored in NVS.
+typedef struct {
+    uint16_t seek_rate;     // mm/min
+    uint16_t feed_rate;     // mm/min
+    uint16_t pulloff_rate;  // mm/min
+    uint16_t tolerance;     // um, 0 disables the tool length check
+    float length;           // expected tool length offset, mm
+} probe_tool_params_t;
+
+static nvs_address_t tool_params_address = 0;
+static probe_tool_params_t tool_params[PROBE_TOOLS + 1];
+
+// Tool change settings overridden while measuring a tool with probing parameters.
+static struct {
+    bool applied;
+    float seek_rate;
+    float feed_rate;
+    float pulloff_rate;
+} tool_params_saved = {0};
+
+#endif
+
+#if PROBE_DIAMETER_ENABLE
+
+#define PROBE_DIAMETER_CLEARANCE 2.0f   // mm, side clearance between tool and toolsetter when approaching
+#define PROBE_DIAMETER_FEED 20.0f       // mm/min, used if the tool change probing feed rate is not set
+#define PROBE_DIAMETER_LINES 11         // lines per spindle orientation, see tooldia_next_line()
+
+// Radial touches on both X sides of the toolsetter at one or two spindle orientations, started by M407.
+static struct {
+    bool active;
+    bool sample;        // next probe cycle is a touch on the side of the toolsetter
+    probe_modal_t modal; // modal state to restore
+    uint_fast8_t orientations;
+    uint_fast8_t line;
+    uint_fast8_t touches;
+    uint32_t tool_id;
+    float center[2];    // toolsetter X and Y in machine coordinates, from G59.3
+    float start[N_AXIS];
+    float radius;       // nominal tool radius
+    float depth;
+    float contact[2][2]; // tool center X at contact, [orientation][side], side 0 is -X
+} tooldia = {0};
+
+#endif
+static probe_event_handler_ptr subscribers[PROBE_SUBSCRIBERS_MAX] = {0};
+static uint_fast8_t n_subscribers = 0;
+static bool connected_published = false;
+
+#if PROBE_PROTECT_DEBUG || PROBE_TRACE_SIZE || PROBE_TOOL_PARAMS_ENABLE
+static on_get_commands_ptr on_get_commands;
+#endif
+
+bool probe_plugin_subscribe (probe_event_handler_ptr handler)
+{
+    bool ok;
+
+    if((ok = n_subscribers < PROBE_SUBSCRIBERS_MAX))
+        subscribers[n_subscribers++] = handler;
+
+    return ok;
+}
+
+static void publish (probe_event_t event, bool succeeded, int32_t *steps)
+{
+    if(n_subscribers) {
+
+        uint_fast8_t idx;
+        probe_result_t result = {
+            .event = event,
+            .probe_id = (uint8_t)probe_id,
+            .succeeded = succeeded,
+            .connected = (uint8_t)probe_connected,
+            .ms = hal.get_elapsed_ticks()
+        };
+
+        system_convert_array_steps_to_mpos(result.position, steps);
+
+        for(idx = 0; idx < n_subscribers; idx++)
+            subscribers[idx](&result);
+    }
+}
+
+#if PROBE_TRACE_SIZE
+
+typedef struct {
+    uint_fast16_t head;
+    uint_fast16_t count;
+    uint8_t cycle;
+    probe_trace_rec_t rec[PROBE_TRACE_SIZE];
+} probe_trace_t;
+
+static probe_trace_t trace = {0};
+
+// Adds a record to the trace ring, the oldest record is overwritten when full.
+static void trace_store (probe_trace_rec_t *rec, probe_trace_type_t type, uint8_t flags, float feed_rate)
+{
+    rec->type = (uint8_t)type;
+    rec->probe_id = (uint8_t)probe_id;
+    rec->flags = flags;
+    rec->cycle = trace.cycle;
+    rec->ms = hal.get_elapsed_ticks();
+    rec->feed_rate = feed_rate;
+
+    // the record is written in the critical section so a dump or a nested call never sees it half written.
+    hal.irq_disable();
+
+    trace.rec[trace.head] = *rec;
+    if(++trace.head == PROBE_TRACE_SIZE)
+        trace.head = 0;
+    if(trace.count < PROBE_TRACE_SIZE)
+        trace.count++;
+
+    hal.irq_enable();
+}
+
+static void trace_add (probe_trace_type_t type, uint8_t flags, float feed_rate, float *position)
+{
+    uint_fast8_t idx;
+    probe_trace_rec_t rec;
+
+    for(idx = 0; idx < PROBE_TRACE_AXES; idx++)
+        rec.position[idx] = position && idx < N_AXIS ? (int32_t)lroundf(position[idx] * 1000.0f) : 0;
+
+    trace_store(&rec, type, flags, feed_rate);
+}
+
+static void trace_add_tool (uint32_t tool_id)
+{
+    probe_trace_rec_t rec;
+
+    memset(&rec, 0, sizeof(probe_trace_rec_t));
+    rec.tool_id = tool_id;
+
+    trace_store(&rec, ProbeTrace_ToolSelected, 0, 0.0f);
+}
+
+static void trace_add_steps (probe_trace_type_t type, uint8_t flags, float feed_rate, int32_t *steps)
+{
+    float position[N_AXIS];
+
+    system_convert_array_steps_to_mpos(position, steps);
+    trace_add(type, flags, feed_rate, position);
+}
+
+
+#endif
+
+#if PROBE_HISTORY_SIZE || PROBE_FIT_ENABLE || PROBE_POINTS_ENABLE
+
+// Trigger position of the last probe cycle in work coordinates and program units.
+static void probe_wpos (float *position)
+{
+    uint_fast8_t axis;
+
+    system_convert_array_steps_to_mpos(position, sys.probe_position);
+
+    for(axis = 0; axis < N_AXIS; axis++) {
+        position[axis] -= gc_state.modal.coord_system.xyz[axis] + gc_state.g92_coord_offset[axis] + gc_state.tool_length_offset[axis];
+        if(gc_state.modal.units_imperial)
+            position[axis] /= 25.4f;
+    }
+}
+
+#endif
+
+#if PROBE_HISTORY_SIZE
+
+typedef struct {
+    float position[N_AXIS];
+    uint8_t probe_id;
+    bool succeeded;
+} probe_history_t;
+
+static struct {
+    uint_fast8_t head;
+    uint_fast8_t count;
+    probe_history_t result[PROBE_HISTORY_SIZE];
+} history = {0};
+
+// Adds a result to the history ring and mirrors the ring to numbered parameters, latest first:
+//   #<base + n * 10 + axis>  trigger position in work coordinates and program units, axis 0 = X
+//   #<base + n * 10 + 8>     probe id, 0: probe, 1: toolsetter
+//   #<base + n * 10 + 9>     1 if the probe cycle succeeded, else 0
+// Entries not yet used are not set.
+static void probe_history_add (bool succeeded)
+{
+    uint_fast8_t idx, n, axis;
+    probe_history_t *result = &history.result[history.head];
+
+    probe_wpos(result->position);
+    result->probe_id = (uint8_t)probe_id;
+    result->succeeded = succeeded;
+
+    history.head = (history.head + 1) % PROBE_HISTORY_SIZE;
+    if(history.count < PROBE_HISTORY_SIZE)
+        history.count++;
+
+    for(n = 0; n < history.count; n++) {
+        idx = (history.head + PROBE_HISTORY_SIZE - 1 - n) % PROBE_HISTORY_SIZE;
+        result = &history.result[idx];
+        for(axis = 0; axis < N_AXIS; axis++)
+            ngc_param_set(PROBE_HISTORY_PARAM_BASE + n * 10 + axis, result->position[axis]);
+        ngc_param_set(PROBE_HISTORY_PARAM_BASE + n * 10 + 8, (float)result->probe_id);
+        ngc_param_set(PROBE_HISTORY_PARAM_BASE + n * 10 + 9, result->succeeded ? 1.0f : 0.0f);
+    }
+}
+
+#endif
+
+static void protection_tripped_msg (uint_fast16_t state)
+{
+#if PROBE_TRACE_SIZE
+    trace_add_steps(ProbeTrace_Tripped, 0, 0.0f, sys.position);
+#endif
+    publish(ProbeEvent_Tripped, false, sys.position);
+}
+
+#if PROBE_PROTECT_DEBUG
+
+typedef struct {
+    uint32_t calls;
+    uint32_t ticks_last;
+    uint32_t ticks_max;
+    uint_fast8_t depth;
+    uint_fast8_t depth_max;
+    uint32_t chain_errors;
+    const char *chain_error;
+} hook_debug_t;
+
+static volatile hook_debug_t hook_debug = {0};
+
+static void chain_error_msg (uint_fast16_t state)
+{
+    char msg[60];
+
+    sprintf(msg, "Probe plugin: hook chain error in %s", hook_debug.chain_error);
+    report_message(msg, Message_Warning);
+}
+
+static void chain_error (const char *where)
+{
+    hook_debug.chain_errors++;
+    hook_debug.chain_error = where;
+    protocol_enqueue_rt_command(chain_error_msg);
+}
+
+#endif
+
+// Probe connected state is a single word updated atomically since it is written both from the foreground and from
+// the connected pin interrupt, and read from realtime command context.
+static void connected_set (uint_fast16_t bits, bool on)
+{
+    if(on)
+        hal.set_bits_atomic(&probe_connected, bits);
+    else
+        hal.clear_bits_atomic(&probe_connected, bits);
+}
 
+static inline probe_connected_flags_t connected_get (void)
+{
+    return (probe_connected_flags_t){ .value = (uint8_t)probe_connected };
+}
+
+// The interrupt carries the sampled pin level so the pin does not have to be read again in the foreground.
 ISR_CODE static void set_connected (uint8_t irq_port, bool is_high)
 {
+    connected_set(PROBE_CONNECTED_EXT_PIN, is_high != probe_protect_settings.flags.ext_pin_inv);
     grbl.enqueue_realtime_command(CMD_PROBE_CONNECTED_TOGGLE);
 }
 
+// Words of the last validated M-code block, validation clears them before the block is executed.
+static words_t mcode_words;
+
 static user_mcode_t mcode_check (user_mcode_t mcode)
 {
-    return mcode == (user_mcode_t)401 || mcode == (user_mcode_t)402
+    return mcode >= (user_mcode_t)401 && mcode <= (user_mcode_t)414
                      ? mcode
                      : (user_mcode.check ? user_mcode.check(mcode) : UserMCode_Ignore);
 }
@@ -134,6 +885,8 @@ static status_code_t mcode_validate (parser_block_t *gc_block, parameter_words_t
 {
     status_code_t state = Status_OK;
 
+    mcode_words = gc_block->words;
+
     switch((uint16_t)gc_block->user_mcode) {
 
         case 401:
@@ -142,6 +895,195 @@ static status_code_t mcode_validate (parser_block_t *gc_block, parameter_words_t
         case 402:
             break;
 
+        case 403: // M403 [P<1-6>] [I<x>] [J<y>] [K<z>] [R<radius>]
+            if(gc_block->words.p) {
+                if(gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 1.0f || gc_block->values.p > 6.0f)
+                    state = Status_GcodeValueOutOfRange;
+                gc_block->words.p = Off;
+            }
+            if(gc_block->words.r) {
+                if(gc_block->values.r < 0.0f)
+                    state = Status_GcodeValueOutOfRange;
+                gc_block->words.r = Off;
+            }
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = Off;
+            break;
+
+        case 405: // M405 P<point id>
+            if(!gc_block->words.p)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 0.0f || gc_block->values.p > 65535.0f)
+                state = Status_GcodeValueOutOfRange;
+#if !PROBE_POINT_CACHE_SIZE
+            else
+                state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.p = Off;
+            break;
+
+        case 406: // M406 I|J|K<distance> Q<max feed rate> [E<start feed rate>] [L<repeats>] [S<0|1>]
+#if PROBE_TUNE_ENABLE
+            if((gc_block->words.i + gc_block->words.j + gc_block->words.k) != 1 || !gc_block->words.q)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.ijk[gc_block->words.i ? X_AXIS : (gc_block->words.j ? Y_AXIS : Z_AXIS)] == 0.0f ||
+                     gc_block->values.q <= 0.0f || (gc_block->words.e && (gc_block->values.e <= 0.0f || gc_block->values.e > gc_block->values.q)))
+                state = Status_GcodeValueOutOfRange;
+            else if(gc_block->words.l && (gc_block->values.l < 2 || gc_block->values.l > 20))
+                state = Status_GcodeValueOutOfRange;
+            else if(gc_block->words.s && !(gc_block->values.s == 0.0f || gc_block->values.s == 1.0f))
+                state = Status_GcodeValueOutOfRange;
+            else if(tune.active)
+                state = Status_InvalidStatement;
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = gc_block->words.q = gc_block->words.e = gc_block->words.l = gc_block->words.s = Off;
+            break;
+
+        case 407: // M407 D<nominal tool diameter> [K<depth>] [P<0|1>]
+#if PROBE_DIAMETER_ENABLE
+            if(!gc_block->words.d)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.d <= 0.0f || (gc_block->words.k && gc_block->values.ijk[Z_AXIS] <= 0.0f))
+                state = Status_GcodeValueOutOfRange;
+            else if(gc_block->words.p && !(gc_block->values.p == 0.0f || gc_block->values.p == 1.0f))
+                state = Status_GcodeValueOutOfRange;
+            else if(probe_protect_settings.setter_diameter == 0.0f)
+                state = Status_SettingDisabled;
+            else if(tooldia.active)
+                state = Status_InvalidStatement;
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.d = gc_block->words.k = gc_block->words.p = Off;
+            break;
+
+        case 408: // M408 [P<tool>]
+            if(gc_block->words.p) {
+                if(gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 0.0f || gc_block->values.p > (float)PROBE_TOOLS)
+                    state = Status_GcodeValueOutOfRange;
+                gc_block->words.p = Off;
+            }
+#if !PROBE_TOOL_CHECK_ENABLE
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            break;
+
+        case 409: // M409 P<tool> [D<seek rate>] [E<feed rate>] [R<pulloff rate>] [K<expected length>] [Q<tolerance>]
+#if PROBE_TOOL_PARAMS_ENABLE
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+
+                if(!gc_block->words.p)
+                    state = Status_GcodeValueWordMissing;
+                else if(gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 0.0f || gc_block->values.p > (float)PROBE_TOOLS)
+                    state = Status_GcodeValueOutOfRange;
+                else if((gc_block->words.d && (gc_block->values.d < 0.0f || gc_block->values.d * scale > 65535.0f)) ||
+                         (gc_block->words.e && (gc_block->values.e < 0.0f || gc_block->values.e * scale > 65535.0f)) ||
+                          (gc_block->words.r && (gc_block->values.r < 0.0f || gc_block->values.r * scale > 65535.0f)) ||
+                           (gc_block->words.q && (gc_block->values.q < 0.0f || gc_block->values.q * scale > 65.535f)))
+                    state = Status_GcodeValueOutOfRange;
+                else if(!tool_params_address)
+                    state = Status_SettingDisabled;
+            }
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.p = gc_block->words.d = gc_block->words.e = gc_block->words.r = gc_block->words.k = gc_block->words.q = Off;
+            break;
+
+        case 410: // M410 [P<0-3>]
+            if(gc_block->words.p && (gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 0.0f || gc_block->values.p > 3.0f))
+                state = Status_GcodeValueOutOfRange;
+#if !PROBE_FIT_ENABLE
+            else
+                state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.p = Off;
+            break;
+
+        case 411: // M411 I<x length> J<y length> P<columns> Q<rows> K<depth> [E<feed rate>]
+#if PROBE_GRID_ENABLE
+            if(!(gc_block->words.i && gc_block->words.j && gc_block->words.p && gc_block->words.q && gc_block->words.k))
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 2.0f || gc_block->values.p > 1000.0f ||
+                     gc_block->values.q != truncf(gc_block->values.q) || gc_block->values.q < 2.0f || gc_block->values.q > 1000.0f ||
+                      gc_block->values.ijk[Z_AXIS] <= 0.0f || (gc_block->words.e && gc_block->values.e <= 0.0f))
+                state = Status_GcodeValueOutOfRange;
+            else if(points.active)
+                state = Status_InvalidStatement;
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = gc_block->words.p = gc_block->words.q = gc_block->words.e = Off;
+            break;
+
+        case 412: // M412 I<x length> J<y length> P<columns> Q<rows> K<depth> R<tolerance> [L<levels>] [E<feed rate>]
+#if PROBE_HEIGHTMAP_ENABLE
+            if(!(gc_block->words.i && gc_block->words.j && gc_block->words.p && gc_block->words.q && gc_block->words.k && gc_block->words.r))
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 2.0f ||
+                     gc_block->values.q != truncf(gc_block->values.q) || gc_block->values.q < 2.0f ||
+                      gc_block->values.p * gc_block->values.q > (float)PROBE_HEIGHTMAP_NODES ||
+                       gc_block->values.ijk[Z_AXIS] <= 0.0f || gc_block->values.r <= 0.0f || (gc_block->words.e && gc_block->values.e <= 0.0f) ||
+                        (gc_block->words.l && (gc_block->values.l < 1 || gc_block->values.l > PROBE_HEIGHTMAP_LEVELS)))
+                state = Status_GcodeValueOutOfRange;
+            else if(points.active)
+                state = Status_InvalidStatement;
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = gc_block->words.p = gc_block->words.q = gc_block->words.r = gc_block->words.l = gc_block->words.e = Off;
+            break;
+
+        case 413: // M413 [I<x> J<y>] | [K<depth> [E<feed rate>]]
+#if PROBE_POINT_LIST_SIZE
+            if(gc_block->words.i != gc_block->words.j || (gc_block->words.e && !gc_block->words.k))
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->words.k && gc_block->words.i)
+                state = Status_InvalidStatement;
+            else if(gc_block->words.k && (gc_block->values.ijk[Z_AXIS] <= 0.0f || (gc_block->words.e && gc_block->values.e <= 0.0f)))
+                state = Status_GcodeValueOutOfRange;
+            else if(gc_block->words.i && point_list.n_points == PROBE_POINT_LIST_SIZE)
+                state = Status_GcodeValueOutOfRange;
+            else if(points.active)
+                state = Status_InvalidStatement;
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = gc_block->words.e = Off;
+            break;
+
+        case 414: // M414 K<depth> [P<file number>] [E<feed rate>]
+#if PROBE_POINT_FILE_ENABLE
+            if(!gc_block->words.k)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.ijk[Z_AXIS] <= 0.0f || (gc_block->words.e && gc_block->values.e <= 0.0f) ||
+                     (gc_block->words.p && (gc_block->values.p != truncf(gc_block->values.p) || gc_block->values.p < 0.0f || gc_block->values.p > 255.0f)))
+                state = Status_GcodeValueOutOfRange;
+            else if(points.active)
+                state = Status_InvalidStatement;
+#else
+            state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.k = gc_block->words.p = gc_block->words.e = Off;
+            break;
+
+        case 404: // M404 P<0|1>
+            if(!gc_block->words.p)
+                state = Status_GcodeValueWordMissing;
+            else if(!(gc_block->values.p == 0.0f || gc_block->values.p == 1.0f))
+                state = Status_GcodeValueOutOfRange;
+#if PROBE_SCAN_SIZE
+            else if(gc_block->values.p == 1.0f && !probe_connected)
+                state = Status_InvalidStatement; //probe must be connected
+#else
+            else
+                state = Status_GcodeUnsupportedCommand;
+#endif
+            gc_block->words.p = Off;
+            break;
+
         default:
             state = Status_Unhandled;
             break;
@@ -164,136 +1106,1974 @@ static probe_state_t probeGetState (void)
     return state;
 }
 
+#if PROBE_SCAN_SIZE
+
+typedef struct {
+    int32_t position[N_AXIS];
+    bool triggered;
+} scan_point_t;
+
+// Points are added from the stepper interrupt and streamed out from the foreground.
+static struct {
+    volatile bool active;
+    bool triggered;
+    volatile uint_fast16_t head;
+    uint_fast16_t tail;
+    volatile uint32_t overruns;
+    uint32_t points;
+    scan_point_t point[PROBE_SCAN_SIZE];
+} scan = {0};
+
+#endif
+
+#if PROBE_PROTECT_DEBUG
+static void on_pulse_start (stepper_t *stepper);
+static void onSpindleSetState (spindle_state_t state, float rpm);
+
+// Verifies that our hooks are installed exactly once, called on every protection and probe redirect transition.
+// A self referencing saved pointer means we have wrapped ourselves, a foreign pointer in the HAL
+// while we are armed means another plugin has stacked on top of us and restoring would drop its hook.
+static void hook_chain_check (const char *where)
+{
+    bool ok = stepper_pulse_start != on_pulse_start && on_spindle_set_state != onSpindleSetState && probe_get_state != probeGetState;
+
+    if(ok && pulse_hooked)
+        ok = hal.stepper.pulse_start == on_pulse_start;
+
+    if(ok && probe_get_state)
+        ok = hal.probe.get_state == probeGetState;
+
+    if(!ok)
+        chain_error(where);
+}
+#endif
+
 static void on_pulse_start (stepper_t *stepper){
 
-    probe_state_t probe = hal.probe.get_state();
+#if PROBE_PROTECT_DEBUG
+    uint32_t ticks = PROBE_DEBUG_TICKS();
 
-    if (probe.triggered || !probe.connected) { // Check probe state.
-        grbl.enqueue_realtime_command(CMD_RESET);
-        report_message("PROBE PROTECTED!", Message_Warning);
+    hook_debug.calls++;
+    if(++hook_debug.depth > hook_debug.depth_max)
+        hook_debug.depth_max = hook_debug.depth;
+#endif
+
+    bool armed = protection_armed;
+
+#if PROBE_SCAN_SIZE
+    if(scan.active) {
+
+        plan_block_t *block = plan_get_current_block();
+
+        // Rapids stay protected while scanning, contacts are captured during feed moves only.
+        if(!(armed = block && block->condition.rapid_motion)) {
+
+            probe_state_t probe = hal.probe.get_state();
+
+            // Capture each make and break with the current step position.
+            if(probe.triggered != scan.triggered) {
+
+                uint_fast16_t next = scan.head + 1 == PROBE_SCAN_SIZE ? 0 : scan.head + 1;
+
+                scan.triggered = probe.triggered;
+                if(next == scan.tail)
+                    scan.overruns++;
+                else {
+                    memcpy(scan.point[scan.head].position, sys.position, sizeof(sys.position));
+                    scan.point[scan.head].triggered = probe.triggered;
+                    scan.head = next;
+                }
+            }
+        }
+    }
+#endif
+
+    if(armed) {
+
+        probe_state_t probe = hal.probe.get_state();
+
+        if ((probe.triggered || !probe.connected) && !protection_tripped) { // Check probe state.
+            protection_tripped = true; // report once, cleared on reset.
+            grbl.enqueue_realtime_command(CMD_RESET);
+            report_message("PROBE PROTECTED!", Message_Warning);
+            protocol_enqueue_rt_command(protection_tripped_msg);
+        }
+    }
+
+#if PROBE_PROTECT_DEBUG
+    // own cost only, the chained handler is excluded.
+    if((hook_debug.ticks_last = PROBE_DEBUG_TICKS() - ticks) > hook_debug.ticks_max)
+        hook_debug.ticks_max = hook_debug.ticks_last;
+#endif
+
+    stepper_pulse_start(stepper); // always resolved, it is never cleared once the hook has been installed.
+
+#if PROBE_PROTECT_DEBUG
+    hook_debug.depth--;
+#endif
+}
+
+// Arming is idempotent, the stepper hook is only installed once no matter how many times
+// the probe connected state is toggled.
+static void pulse_hook_install (void)
+{
+    if(!pulse_hooked) {
+        pulse_hooked = true;
+        stepper_pulse_start = hal.stepper.pulse_start;
+        hal.stepper.pulse_start = on_pulse_start;
     }
-    
-    if(stepper_pulse_start)
-        stepper_pulse_start(stepper);
 }
 
 static void protection_on (void){
 
-    stepper_pulse_start = hal.stepper.pulse_start;
-    hal.stepper.pulse_start = on_pulse_start;
+    pulse_hook_install();
+
+    protection_armed = true;
+
+#if PROBE_PROTECT_DEBUG
+    hook_chain_check("protection_on");
+#endif
 }
 
 static void protection_off (void){
-    
-    if(stepper_pulse_start){
+
+#if PROBE_PROTECT_DEBUG
+    hook_chain_check("protection_off");
+#endif
+
+    protection_armed = false;
+
+    // Only unhook if we are still on top of the chain. If another plugin has hooked in after us
+    // our hook is left in place, it is passive while disarmed.
+    if(pulse_hooked && hal.stepper.pulse_start == on_pulse_start
+#if PROBE_SCAN_SIZE
+        && !scan.active
+#endif
+      ) {
         hal.stepper.pulse_start = stepper_pulse_start;
-        stepper_pulse_start = NULL;  //risk of null pointer error?
+        pulse_hooked = false;
+    }
+}
+
+#if PROBE_SCAN_SIZE
+
+// Scanning replaces protection with make and break capture during feed moves, these are not stopped on contact.
+static void scan_start (void)
+{
+    protection_off();
+
+    scan.head = scan.tail = 0;
+    scan.overruns = scan.points = 0;
+    scan.triggered = hal.probe.get_state().triggered;
+    scan.active = true;
+
+    pulse_hook_install();
+}
+
+// Streams captured points in batches of up to PROBE_SCAN_BATCH as machine positions, s is 1 for make and 0 for break:
+//   [SCAN:x,y,z,s|x,y,z,s|...]
+static void scan_report (bool flush)
+{
+    uint_fast8_t idx, n = 0;
+    uint_fast16_t pending = (scan.head + PROBE_SCAN_SIZE - scan.tail) % PROBE_SCAN_SIZE;
+
+    while(pending && (flush || pending >= PROBE_SCAN_BATCH)) {
+
+        hal.stream.write("[SCAN:");
+
+        for(n = 0; n < PROBE_SCAN_BATCH && pending; n++, pending--) {
+            scan_point_t *point = &scan.point[scan.tail];
+            if(n)
+                hal.stream.write("|");
+            for(idx = 0; idx < N_AXIS; idx++) {
+                hal.stream.write(ftoa(system_convert_axis_steps_to_mpos(point->position, idx), 3));
+                hal.stream.write(",");
+            }
+            hal.stream.write(point->triggered ? "1" : "0");
+            scan.points++;
+            scan.tail = scan.tail + 1 == PROBE_SCAN_SIZE ? 0 : scan.tail + 1;
+        }
+
+        hal.stream.write("]" ASCII_EOL);
+    }
+}
+
+static void scan_stop (void)
+{
+    if(scan.active) {
+
+        char msg[50];
+
+        scan.active = false;
+        scan_report(true);
+
+        sprintf(msg, "Scan ended: %lu points, %lu lost", (unsigned long)scan.points, (unsigned long)scan.overruns);
+        report_message(msg, Message_Info);
+
+        if(probe_connected)
+            protection_on();
+        else
+            protection_off();
+    }
+}
+
+#endif
+
+#if PROBE_POINT_CACHE_SIZE
+
+static probe_point_t *point_find (coord_system_id_t wcs, uint16_t point_id)
+{
+    uint_fast8_t idx = PROBE_POINT_CACHE_SIZE;
+    probe_point_t *point = NULL;
+
+    do {
+        idx--;
+        if(point_cache.point[idx].valid && point_cache.point[idx].wcs == wcs && point_cache.point[idx].point_id == point_id)
+            point = &point_cache.point[idx];
+    } while(idx && point == NULL);
+
+    return point;
+}
+
+static void point_store (coord_system_id_t wcs, uint16_t point_id, int32_t *steps)
+{
+    probe_point_t *point;
+
+    if((point = point_find(wcs, point_id)) == NULL) {
+        point = &point_cache.point[point_cache.next];
+        point_cache.next = (point_cache.next + 1) % PROBE_POINT_CACHE_SIZE; // replace oldest
+    }
+
+    point->valid = true;
+    point->wcs = wcs;
+    point->point_id = point_id;
+    system_convert_array_steps_to_mpos(point->contact, steps);
+}
+
+#endif
+
+#if PROBE_POINT_CACHE_SIZE || PROBE_TOOL_CHECK_ENABLE
+
+static float safe_feed_rate (float *start, float *target);
+
+// Position along the probing path from start towards target at standoff before the projection of the
+// expected contact position onto the path. Returns false if it is not ahead on the path.
+static bool approach_position (float *start, float *target, float *contact, float standoff, float *approach)
+{
+    uint_fast8_t idx;
+    float distance = 0.0f, along = 0.0f, delta;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        delta = target[idx] - start[idx];
+        distance += delta * delta;
+        along += delta * (contact[idx] - start[idx]);
+    }
+
+    if(distance == 0.0f)
+        return false;
+
+    distance = sqrtf(distance);
+    along = along / distance - standoff; // distance to approach position along probing path
+
+    if(along <= 0.0f || along >= distance)
+        return false;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        approach[idx] = start[idx] + (target[idx] - start[idx]) * along / distance;
+
+    return true;
+}
+
+// Moves to the approach position at feed_rate. Returns false if the approach was aborted.
+static bool approach_move (float *approach, float feed_rate)
+{
+    plan_line_data_t plan_data;
+
+    plan_data_init(&plan_data);
+    plan_data.feed_rate = feed_rate;
+
+    return mc_line(approach, &plan_data) && protocol_buffer_synchronize() && !sys.abort;
+}
+
+#endif
+
+#if PROBE_POINT_CACHE_SIZE
+
+// Moves to the standoff distance before the remembered contact position along the probing path,
+// the probe cycle then continues at the programmed feed rate from there. The approach is made at the
+// highest feed rate that lets the machine stop within the stylus overtravel and skipped if that is not
+// faster than probing. Protection is still armed during the approach, an early contact trips it and
+// resets the controller. Returns false if the approach was aborted.
+static bool predictive_approach (float *target, plan_line_data_t *pl_data)
+{
+    float start[N_AXIS], approach[N_AXIS], feed_rate;
+    probe_point_t *point;
+
+    if(!(point_cache.tagged && probe_protect_settings.approach_standoff > 0.0f && protection_armed && !pl_data->condition.inverse_time &&
+          (point = point_find(gc_state.modal.coord_system.id, point_cache.point_id))))
+        return true;
+
+    system_convert_array_steps_to_mpos(start, sys.position);
+
+    if(!approach_position(start, target, point->contact, probe_protect_settings.approach_standoff, approach) ||
+        (feed_rate = safe_feed_rate(start, approach)) <= pl_data->feed_rate)
+        return true;
+
+    return approach_move(approach, feed_rate);
+}
+
+#endif
+
+#if PROBE_TOOL_CHECK_ENABLE
+
+// Quick check of a tool measured since power up or reset when measured again in a tool change sequence:
+// shorten the probe move to the tolerance below the last contact position and, if contact is monitored by
+// probe protection, move to the standoff above it at the tool change seek rate when that is faster than the
+// probe move. A longer tool trips protection during the approach, the controller is reset and position is lost.
+// The probe cycle fails if the tool is broken or has been pulled out of the holder.
+static bool tool_check (float *target, plan_line_data_t *pl_data)
+{
+    uint_fast8_t idx;
+    float start[N_AXIS], contact[N_AXIS], approach[N_AXIS];
+    probe_tool_t *tool;
+
+    if(!(probe_protect_settings.options.tool_check && fixture_tool && fixture_tool->tool_id <= PROBE_TOOLS &&
+          (tool = &tools[fixture_tool->tool_id])->measured))
+        return true;
+
+    system_convert_array_steps_to_mpos(start, sys.position);
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(idx != Z_AXIS && target[idx] != start[idx])
+            return true; // not a straight Z move
+    }
+
+    if(target[Z_AXIS] >= start[Z_AXIS])
+        return true;
+
+    if(target[Z_AXIS] < tool->contact - PROBE_TOOL_CHECK_TOLERANCE)
+        target[Z_AXIS] = tool->contact - PROBE_TOOL_CHECK_TOLERANCE;
+
+    if(!protection_armed || settings.tool_change.seek_rate <= pl_data->feed_rate)
+        return true; // a longer tool would hit the toolsetter unnoticed, or the approach is not faster than probing
+
+    memcpy(contact, start, sizeof(contact));
+    contact[Z_AXIS] = tool->contact;
+
+    return !approach_position(start, target, contact, probe_protect_settings.approach_standoff > 0.0f ? probe_protect_settings.approach_standoff : PROBE_TOOL_CHECK_STANDOFF, approach) ||
+            approach_move(approach, settings.tool_change.seek_rate);
+}
+
+// Keeps the toolsetter contact position of each successful tool change measurement.
+static void tool_check_completed (void)
+{
+    float contact[N_AXIS];
+    probe_tool_t *tool = &tools[fixture_tool->tool_id];
+
+    system_convert_array_steps_to_mpos(contact, sys.probe_position);
+
+    if(tool->measured && fabsf(contact[Z_AXIS] - tool->contact) > PROBE_TOOL_CHECK_TOLERANCE)
+        report_message("Tool length changed since last measurement", Message_Warning);
+
+    tool->measured = true;
+    tool->contact = contact[Z_AXIS];
+}
+
+static void tool_check_clear (int32_t tool_id)
+{
+    uint_fast16_t idx = PROBE_TOOLS + 1;
+
+    do {
+        idx--;
+        if(tool_id < 0 || (uint_fast16_t)tool_id == idx)
+            tools[idx].measured = false;
+    } while(idx);
+}
+
+#endif
+
+// Returns the highest feed rate (mm/min) that allows the machine to stop within the stylus overtravel
+// when probing from start towards target. The distance covered is feed * latency + feed^2 / (2 * deceleration),
+// deceleration is the lowest along the probing direction of the axes involved.
+static float safe_feed_rate (float *start, float *target)
+{
+    uint_fast8_t idx;
+    float unit[N_AXIS], accel = 0.0f, latency;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        unit[idx] = target[idx] - start[idx];
+
+    if(convert_delta_vector_to_unit_vector(unit) == 0.0f)
+        return 0.0f;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(unit[idx] != 0.0f) {
+            float axis_accel = settings.axis[idx].acceleration / fabsf(unit[idx]); // mm/min^2
+            if(accel == 0.0f || axis_accel < accel)
+                accel = axis_accel;
+        }
     }
+
+    latency = probe_protect_settings.latency / 60000.0f; // minutes
+
+    return sqrtf(accel * accel * latency * latency + 2.0f * accel * probe_protect_settings.overtravel) - accel * latency;
 }
 
 static bool probe_start (axes_signals_t axes, float *target, plan_line_data_t *pl_data){
     //if probe connected, de-activate protection at the start of a probing move machine will stop on activation
     bool status = true;
+
+#if PROBE_POINT_CACHE_SIZE
+    if(!predictive_approach(target, pl_data))
+        return false;
+#endif
+#if PROBE_TOOL_CHECK_ENABLE
+    if(!tool_check(target, pl_data))
+        return false;
+#endif
+
     protection_off();
 
+    system_convert_array_steps_to_mpos(probe_cycle.start, sys.position);
+    memcpy(probe_cycle.target, target, sizeof(probe_cycle.target));
+
+    // the stylus overtravel does not apply to a toolsetter.
+    if(probe_protect_settings.overtravel > 0.0f && !pl_data->condition.inverse_time && probe_id != ProbeTraceId_Toolsetter) {
+        float feed_rate = safe_feed_rate(probe_cycle.start, target);
+        if(feed_rate > 0.0f && pl_data->feed_rate > feed_rate) {
+            pl_data->feed_rate = feed_rate;
+            if(!overtravel_limit_reported) {
+                overtravel_limit_reported = true;
+                report_message("Probe feed rate limited by stylus overtravel", Message_Plain);
+            }
+        }
+    }
+
+#if PROBE_TRACE_SIZE
+    trace.cycle++;
+    trace_add_steps(ProbeTrace_Start, pl_data->condition.inverse_time ? ProbeTraceFlag_InverseTime : 0, pl_data->feed_rate, sys.position);
+    trace_add(ProbeTrace_Target, 0, pl_data->feed_rate, target);
+#endif
+
     if(on_probe_start)
         status = on_probe_start(axes, target, pl_data);
     
     return status;
 }
 
-static void probe_completed (void){
-    //if probe connected, re-activate protection.
-    protection_on();
+// Writes the contact position of the completed probe cycle to the work offset armed by M403,
+// like G10 L20 does for the current position. Contact on the X and Y axes is compensated
+// for the stylus tip radius along the probing direction.
+static void probe_zero_apply (void)
+{
+    uint_fast8_t idx;
+    float coord[N_AXIS], position[N_AXIS], distance = 0.0f, delta;
+    char msg[40];
 
-    //restore anything changed during tool probing.
-    settings.probe.invert_probe_pin = nvs_invert_probe_pin;
-    hal.limits.enable(settings.limits.flags.hard_enabled, (axes_signals_t){0});  //restore hard limit settings.
+    system_convert_array_steps_to_mpos(position, sys.probe_position);
+    settings_read_coord_data(probe_zero.id, &coord);
 
-    //if probe state was redirected, restore it
-    if(probe_get_state){
-        hal.probe.get_state = probe_get_state;
-        probe_get_state = NULL;
+    for(idx = 0; idx < N_AXIS; idx++) {
+        delta = probe_cycle.target[idx] - probe_cycle.start[idx];
+        distance += delta * delta;
     }
 
-    if(on_probe_completed)
-        on_probe_completed();
+    if((distance = sqrtf(distance)) > 0.0f) for(idx = 0; idx < N_AXIS; idx++) {
+
+        delta = probe_cycle.target[idx] - probe_cycle.start[idx];
+
+        if(probe_zero.axes.value ? bit_istrue(probe_zero.axes.value, bit(idx)) : delta != 0.0f) {
+            if(idx != Z_AXIS)
+                position[idx] += probe_zero.radius * delta / distance;
+            coord[idx] = position[idx] - gc_state.g92_coord_offset[idx] - gc_state.tool_length_offset[idx] - probe_zero.value[idx];
+        }
+    }
+
+    settings_write_coord_data(probe_zero.id, &coord);
+
+    if(gc_state.modal.coord_system.id == probe_zero.id) {
+        memcpy(gc_state.modal.coord_system.xyz, coord, sizeof(coord));
+        system_flag_wco_change();
+    }
+
+    sprintf(msg, "Work offset G%d updated", 54 + (int)probe_zero.id);
+    report_message(msg, Message_Info);
 }
 
-// When called from "normal" probing tool is always NULL, when called from within
-// a tool change sequence (M6) then tool is a pointer to the selected tool.
-bool probe_fixture (tool_data_t *tool, bool at_g59_3, bool on)
+#if PROBE_TUNE_ENABLE
+
+// Called on completion of each probe cycle, only the probe moves towards the surface are sampled.
+static void tune_sample (void)
 {
-    bool status = true;
+    float trigger[N_AXIS], stop[N_AXIS];
 
-    if(tool){ //are doing a tool change.
+    if(tune.step != TuneStep_Release || !sys.flags.probe_succeeded)
+        return;
 
-        //set polarity before probing the fixture.
-        if(probe_protect_settings.flags.invert)
-            settings.probe.invert_probe_pin = !nvs_invert_probe_pin;
-        
-        //if a different pin is configured, re-direct probe reading to that pin via function pointer.
-        if(probe_protect_settings.flags.tool_pin){
-            //store current probe state
-            probe = hal.probe.get_state();
-            probe_get_state = hal.probe.get_state;
-            hal.probe.get_state = probeGetState;
+    system_convert_array_steps_to_mpos(trigger, sys.probe_position);
+    system_convert_array_steps_to_mpos(stop, sys.position);
+
+    if(tune.count == 0 || trigger[tune.axis] < tune.min)
+        tune.min = trigger[tune.axis];
+    if(tune.count == 0 || trigger[tune.axis] > tune.max)
+        tune.max = trigger[tune.axis];
+    if(tune.count == 0 || fabsf(stop[tune.axis] - trigger[tune.axis]) > tune.overtravel)
+        tune.overtravel = fabsf(stop[tune.axis] - trigger[tune.axis]);
+
+    tune.count++;
+}
+
+#endif
+
+#if PROBE_DIAMETER_ENABLE
+
+static void tooldia_sample (void)
+{
+    if(tooldia.sample) {
+
+        tooldia.sample = false;
+
+        if(sys.flags.probe_succeeded) {
+            float contact[N_AXIS];
+            uint_fast8_t side = tooldia.touches & 1, orientation = tooldia.touches >> 1;
+
+            system_convert_array_steps_to_mpos(contact, sys.probe_position);
+            tooldia.contact[orientation][side] = contact[X_AXIS];
+            tooldia.touches++;
         }
+    }
+}
 
-        //set hard limits before probing the fixture.
-        if(!settings.limits.flags.hard_enabled && probe_protect_settings.flags.hardlimits){ //if the hard limits are not already enabled they need to be enabled.
-            hal.limits.enable(true, (axes_signals_t){0}); // Change immediately. NOTE: Nice to have but could be problematic later.
+#endif
+
+#if PROBE_GRID_ENABLE || PROBE_HEIGHTMAP_ENABLE
+
+// Serpentine order, odd rows are traversed in reverse so each row starts above the end of the previous one.
+static void points_serpentine (uint_fast32_t n, uint_fast16_t columns, uint_fast16_t *col, uint_fast16_t *row)
+{
+    *row = n / columns;
+    *col = (*row & 1) ? columns - 1 - n % columns : n % columns;
+}
+
+#endif
+
+#if PROBE_GRID_ENABLE
+
+static float grid_deviation (probe_fit_result_t *result, grid_point_t *point)
+{
+    return point->z - (result->value[0] * point->x + result->value[1] * point->y + result->value[2]);
+}
+
+// Adds the point to the plane sums and keeps it as a candidate if it deviates more from the plane fitted
+// so far than the least deviating candidate, which is then dropped. If the plane cannot be fitted yet
+// the point is kept if it is the lowest or highest such point.
+static void grid_sample (float *position)
+{
+    grid_point_t point;
+    probe_fit_result_t result;
+
+    point.x = position[X_AXIS];
+    point.y = position[Y_AXIS];
+    point.z = position[Z_AXIS];
+
+    probe_fit_add(&grid.plane, point.x, point.y, point.z);
+
+    if(grid.n_candidates < PROBE_GRID_CANDIDATES)
+        grid.candidate[grid.n_candidates++] = point;
+
+    else if(probe_fit_solve(&grid.plane, &result)) {
+
+        uint_fast8_t idx, min_idx = 0;
+        float deviation, min_deviation = 0.0f;
+
+        for(idx = 0; idx < PROBE_GRID_CANDIDATES; idx++) {
+            deviation = fabsf(grid_deviation(&result, &grid.candidate[idx]));
+            if(idx == 0 || deviation < min_deviation) {
+                min_deviation = deviation;
+                min_idx = idx;
+            }
+        }
+
+        if(fabsf(grid_deviation(&result, &point)) > min_deviation)
+            grid.candidate[min_idx] = point;
+
+    } else if(!grid.unsolved) {
+        grid.unsolved = true;
+        grid.low = grid.high = point;
+    } else if(point.z < grid.low.z)
+        grid.low = point;
+    else if(point.z > grid.high.z)
+        grid.high = point;
+}
+
+#endif
+
+#if PROBE_HEIGHTMAP_ENABLE
+
+static const uint8_t hmap_midpoint[] = { 1, 3, 5, 7 };
+
+static inline uint_fast8_t hmap_slot (hmap_cell_t *cell)
+{
+    return cell->stage == 0 ? 4 : hmap_midpoint[cell->stage - 1];
+}
+
+// Reports the point and stores the height in the coarse grid or the cell being refined.
+static void hmap_sample (float *position)
+{
+    uint_fast16_t col, row;
+    hmap_point_t *point;
+
+    hmap.points++;
+
+    hal.stream.write("[HMAP:");
+    hal.stream.write(ftoa(position[X_AXIS], 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(position[Y_AXIS], 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(position[Z_AXIS], 4));
+    hal.stream.write("]" ASCII_EOL);
+
+    if(hmap.node < hmap.columns * hmap.rows) {
+        points_serpentine(hmap.node++, hmap.columns, &col, &row);
+        hmap.z[row * hmap.columns + col] = position[Z_AXIS];
+    }
+
+    else if(hmap.n_cells) {
+        hmap_cell_t *cell = &hmap.cells[hmap.n_cells - 1];
+        cell->z[hmap_slot(cell)] = position[Z_AXIS];
+        cell->stage++;
+        point = &hmap.cache[hmap.cache_head];
+        point->x = points.xy[0];
+        point->y = points.xy[1];
+        point->z = position[Z_AXIS];
+        hmap.cache_head = (hmap.cache_head + 1) % PROBE_HEIGHTMAP_CACHE;
+        if(hmap.n_cached < PROBE_HEIGHTMAP_CACHE)
+            hmap.n_cached++;
+    }
+}
+
+#endif
+
+#if PROBE_POINT_LIST_SIZE
+
+// Reports the point as [PNT:<index>,<x>,<y>,<z>] where index is the position in the list in the order added.
+static void point_list_sample (float *position)
+{
+    hal.stream.write("[PNT:");
+    hal.stream.write(uitoa(point_list.order[point_list.next - 1]));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(position[X_AXIS], 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(position[Y_AXIS], 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(position[Z_AXIS], 4));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+#endif
+
+#if PROBE_POINTS_ENABLE
+
+static void points_sample (void)
+{
+    float position[N_AXIS];
+
+    points.sample = false;
+
+    if(sys.flags.probe_succeeded) {
+        system_convert_array_steps_to_mpos(position, sys.probe_position);
+        points.contact_z = position[Z_AXIS];
+        points.contacted = true;
+        probe_wpos(position);
+        points.job->sample(position);
+    }
+}
+
+#endif
+
+static void probe_completed (void){
+
+    if(probe_zero.armed) {
+        probe_zero.armed = false;
+        if(sys.flags.probe_succeeded)
+            probe_zero_apply();
+        else
+            report_message("Probe failed, work offset not updated", Message_Warning);
+    }
+
+#if PROBE_TRACE_SIZE
+    trace_add_steps(ProbeTrace_Trigger, sys.flags.probe_succeeded ? ProbeTraceFlag_Succeeded : 0, 0.0f, sys.probe_position);
+#endif
+    publish(ProbeEvent_Completed, sys.flags.probe_succeeded, sys.probe_position);
+#if PROBE_POINT_CACHE_SIZE
+    if(point_cache.tagged) {
+        point_cache.tagged = false;
+        if(sys.flags.probe_succeeded)
+            point_store(gc_state.modal.coord_system.id, point_cache.point_id, sys.probe_position);
+    }
+#endif
+#if PROBE_HISTORY_SIZE
+    probe_history_add(sys.flags.probe_succeeded);
+#endif
+#if PROBE_TUNE_ENABLE
+    if(tune.active)
+        tune_sample();
+#endif
+#if PROBE_FIT_ENABLE
+    if(fit.type != ProbeFit_None && sys.flags.probe_succeeded) {
+        float position[N_AXIS];
+        probe_wpos(position);
+        probe_fit_add(&fit, position[X_AXIS], position[Y_AXIS], position[Z_AXIS]);
+    }
+#endif
+#if PROBE_DIAMETER_ENABLE
+    if(tooldia.active)
+        tooldia_sample();
+#endif
+#if PROBE_POINTS_ENABLE
+    if(points.active && points.sample)
+        points_sample();
+#endif
+#if PROBE_TOOL_CHECK_ENABLE
+    if(fixture_tool && fixture_tool->tool_id <= PROBE_TOOLS && sys.flags.probe_succeeded)
+        tool_check_completed();
+#endif
+    probe_id = ProbeTraceId_Probe;
+
+    //if probe connected, re-activate protection.
+    if(probe_connected
+#if PROBE_SCAN_SIZE
+        && !scan.active
+#endif
+      )
+        protection_on();
+
+    //restore anything changed during tool probing.
+    settings.probe.invert_probe_pin = nvs_invert_probe_pin;
+    hal.limits.enable(settings.limits.flags.hard_enabled, (axes_signals_t){0});  //restore hard limit settings.
+
+    //if probe state was redirected, restore it
+#if PROBE_PROTECT_DEBUG
+    hook_chain_check("probe_completed");
+#endif
+    if(probe_get_state){
+        hal.probe.get_state = probe_get_state;
+        probe_get_state = NULL;
+    }
+
+    if(on_probe_completed)
+        on_probe_completed();
+}
+
+#if PROBE_TOOL_PARAMS_ENABLE
+
+static void tool_params_restore (void)
+{
+    if(tool_params_saved.applied) {
+        tool_params_saved.applied = false;
+        settings.tool_change.seek_rate = tool_params_saved.seek_rate;
+        settings.tool_change.feed_rate = tool_params_saved.feed_rate;
+        settings.tool_change.pulloff_rate = tool_params_saved.pulloff_rate;
+    }
+}
+
+// Overrides the tool change probing rates for the duration of the tool measurement, the core reads them
+// from settings for each probe cycle. Settings are not written to NVS.
+static void tool_params_apply (tool_data_t *tool)
+{
+    probe_tool_params_t *params;
+
+    tool_params_restore();
+
+    if(tool->tool_id > PROBE_TOOLS)
+        return;
+
+    params = &tool_params[tool->tool_id];
+
+    if(params->seek_rate || params->feed_rate || params->pulloff_rate) {
+
+        tool_params_saved.applied = true;
+        tool_params_saved.seek_rate = settings.tool_change.seek_rate;
+        tool_params_saved.feed_rate = settings.tool_change.feed_rate;
+        tool_params_saved.pulloff_rate = settings.tool_change.pulloff_rate;
+
+        if(params->seek_rate)
+            settings.tool_change.seek_rate = (float)params->seek_rate;
+        if(params->feed_rate)
+            settings.tool_change.feed_rate = (float)params->feed_rate;
+        if(params->pulloff_rate)
+            settings.tool_change.pulloff_rate = (float)params->pulloff_rate;
+    }
+}
+
+// Checks the tool length offset set by the tool change against the expected length, holds the program if out of tolerance.
+static void onToolChanged (tool_data_t *tool)
+{
+    tool_params_restore();
+
+    if(tool && tool->tool_id <= PROBE_TOOLS && tool_params[tool->tool_id].tolerance &&
+        fabsf(gc_state.tool_length_offset[Z_AXIS] - tool_params[tool->tool_id].length) > (float)tool_params[tool->tool_id].tolerance / 1000.0f) {
+        grbl.enqueue_realtime_command(CMD_FEED_HOLD);
+        report_message("Tool length out of tolerance, program held", Message_Warning);
+    }
+
+    if(on_tool_changed)
+        on_tool_changed(tool);
+}
+
+#endif
+
+// When called from "normal" probing tool is always NULL, when called from within
+// a tool change sequence (M6) then tool is a pointer to the selected tool.
+bool probe_fixture (tool_data_t *tool, bool at_g59_3, bool on)
+{
+    bool status = true, toolsetter = tool != NULL;
+
+#if PROBE_DIAMETER_ENABLE
+    toolsetter |= tooldia.active; // radial touches are set up as for a tool change measurement
+#endif
+
+    if(on && (toolsetter || at_g59_3))
+        probe_id = ProbeTraceId_Toolsetter;
+
+#if PROBE_TOOL_CHECK_ENABLE
+    fixture_tool = on ? tool : NULL;
+#endif
+
+#if PROBE_TOOL_PARAMS_ENABLE
+    if(tool && on)
+        tool_params_apply(tool);
+    else
+        tool_params_restore();
+#endif
+
+    if(toolsetter && on){ //are doing a tool change or measuring a tool.
+
+        //set polarity before probing the fixture.
+        if(probe_protect_settings.flags.invert)
+            settings.probe.invert_probe_pin = !nvs_invert_probe_pin;
+        
+        //if a different pin is configured, re-direct probe reading to that pin via function pointer.
+        if(probe_protect_settings.flags.tool_pin && probe_get_state == NULL){
+            //store current probe state
+            probe = hal.probe.get_state();
+            probe_get_state = hal.probe.get_state;
+            hal.probe.get_state = probeGetState;
+#if PROBE_PROTECT_DEBUG
+            hook_chain_check("probe_fixture");
+#endif
+        }
+
+        //set hard limits before probing the fixture.
+        if(!settings.limits.flags.hard_enabled && probe_protect_settings.flags.hardlimits){ //if the hard limits are not already enabled they need to be enabled.
+            hal.limits.enable(true, (axes_signals_t){0}); // Change immediately. NOTE: Nice to have but could be problematic later.
+        }
+        hal.delay_ms(RELAY_DEBOUNCE, NULL); // Delay a bit to let any contact bounce settle.
+    } else if(!on && probe_get_state){
+        //released without a completed probe cycle, e.g. when triggered before the move started.
+        hal.probe.get_state = probe_get_state;
+        probe_get_state = NULL;
+    }
+
+    if(on_probe_fixture)
+        status = on_probe_fixture(tool, at_g59_3, on);
+
+    return status;
+}
+
+// Line runner, feeds lines to the parser in place of the input stream. Lines are taken from
+// a string, when exhausted the next_line generator is called for more if provided.
+
+typedef bool (*probe_next_line_ptr)(char *line);
+typedef void (*probe_runner_end_ptr)(bool completed);
+
+static struct {
+    const char *name;
+    const char *data;   // next character to execute, NULL when nothing is running
+    probe_next_line_ptr next_line;
+    probe_runner_end_ptr on_end;
+    stream_read_ptr stream_read;
+    status_message_ptr status_message;
+    bool defer_status;      // status of the line that started the runner is reported when it ends
+    status_code_t status;   // error that terminated the runner
+    char line[PROBE_LINE_SIZE];
+} runner = {0};
+
+static void runner_end (bool completed)
+{
+    if(runner.data) {
+        runner.data = NULL;
+        hal.stream.read = runner.stream_read;
+        grbl.report.status_message = runner.status_message;
+        if(runner.on_end)
+            runner.on_end(completed);
+        // nothing is reported when ended by a reset.
+        if(runner.defer_status && (completed || runner.status != Status_OK))
+            runner.status_message(completed ? Status_OK : runner.status);
+    }
+}
+
+static int16_t runner_get_char (void)
+{
+    if(*runner.data == '\0') {
+        if(runner.next_line && runner.next_line(runner.line))
+            runner.data = runner.line;
+        else {
+            runner_end(true);
+            return SERIAL_NO_DATA;
+        }
+    }
+
+    return (int16_t)*runner.data++;
+}
+
+// Status messages for runner lines are not passed on to the stream, a sender counting
+// its own ok responses would otherwise get out of sync. Errors terminate the runner.
+static status_code_t runner_status_message (status_code_t status_code)
+{
+    if(status_code != Status_OK) {
+        char msg[40];
+
+        sprintf(msg, "Probe %s: error %d", runner.name, (int)status_code);
+        report_message(msg, Message_Warning);
+        runner.status = status_code;
+        runner_end(false);
+    }
+
+    return status_code;
+}
+
+// Input is redirected from the stream to the runner, should only be called when the controller is idle.
+static bool runner_start (const char *name, const char *data, probe_next_line_ptr next_line, probe_runner_end_ptr on_end)
+{
+    if(runner.data)
+        return false;
+
+    runner.name = name;
+    runner.data = data;
+    runner.next_line = next_line;
+    runner.on_end = on_end;
+    runner.defer_status = false;
+    runner.status = Status_OK;
+    runner.stream_read = hal.stream.read;
+    runner.status_message = grbl.report.status_message;
+    hal.stream.read = runner_get_char;
+    grbl.report.status_message = runner_status_message;
+
+    return true;
+}
+
+#if PROBE_TUNE_ENABLE || PROBE_DIAMETER_ENABLE || PROBE_POINTS_ENABLE
+
+// Called from the M-code execute handler after motion is synchronized, no further lines are read from
+// the stream until the runner ends. The ok for the M-code line is held back until then so a sender
+// waiting for it does not stream the next line early, an error ending the runner is reported instead.
+static bool runner_start_mcode (const char *name, probe_next_line_ptr next_line, probe_runner_end_ptr on_end)
+{
+    bool ok;
+
+    if((ok = runner_start(name, "", next_line, on_end)))
+        runner.defer_status = true;
+    else {
+        char msg[40];
+
+        sprintf(msg, "Probe %s: busy, not started", name);
+        report_message(msg, Message_Warning);
+    }
+
+    return ok;
+}
+
+static void modal_save (probe_modal_t *modal)
+{
+    modal->imperial = gc_state.modal.units_imperial;
+    modal->incremental = gc_state.modal.distance_incremental;
+    modal->motion = gc_state.modal.motion;
+    modal->feed_rate = gc_state.feed_rate;
+}
+
+// Last line of a job, restores units and distance mode.
+static void modal_line (probe_modal_t *modal, char *line)
+{
+    sprintf(line, "%s%s\n", modal->imperial ? "G20" : "G21", modal->incremental ? "G91" : "G90");
+}
+
+// Called when the job ends, motion mode and feed rate are restored directly since a line can not set
+// every motion mode without a move. Units and distance mode too if the job did not complete.
+static void modal_restore (probe_modal_t *modal, bool completed)
+{
+    if(!completed) {
+        gc_state.modal.units_imperial = modal->imperial;
+        gc_state.modal.distance_incremental = modal->incremental;
+    }
+    gc_state.modal.motion = modal->motion;
+    gc_state.feed_rate = modal->feed_rate;
+}
+
+#endif
+
+#if PROBE_MACROS_ENABLE
+
+typedef struct {
+    const char *filename;
+    bool loaded;
+    char data[PROBE_MACRO_SIZE];
+} probe_macro_t;
+
+static probe_macro_t macros[] = {
+    { .filename = PROBE_CONNECT_MACRO },
+    { .filename = PROBE_DISCONNECT_MACRO }
+};
+
+static probe_macro_t * volatile macro_pending = NULL;
+
+// Macros are read from the file system on first use only, the cache is cleared when settings are changed.
+static bool macro_load (probe_macro_t *pmacro)
+{
+    if(!pmacro->loaded) {
+
+        vfs_file_t *file;
+        size_t len = 0;
+        char c;
+
+        if((file = vfs_open(pmacro->filename, "r"))) {
+            // room is needed for a line terminator if missing and the string terminator.
+            len = vfs_read(pmacro->data, 1, PROBE_MACRO_SIZE - 1, file);
+            if(len == PROBE_MACRO_SIZE - 1 && (pmacro->data[len - 1] != ASCII_LF || vfs_read(&c, 1, 1, file) == 1)) {
+                len = 0;
+                report_message("Probe macro: file too large, not run", Message_Warning);
+            }
+            vfs_close(file);
+        } else
+            report_message("Probe macro: file not found", Message_Warning);
+
+        if(len && pmacro->data[len - 1] != ASCII_LF)
+            pmacro->data[len++] = ASCII_LF;
+        pmacro->data[len] = '\0';
+        pmacro->loaded = true;
+    }
+
+    return *pmacro->data != '\0';
+}
+
+static void macro_clear_cache (void)
+{
+    uint_fast8_t idx = sizeof(macros) / sizeof(probe_macro_t);
+
+    do {
+        macros[--idx].loaded = false;
+    } while(idx);
+}
+
+// Macros are started when the controller is idle.
+static void macro_poll (sys_state_t state)
+{
+    if(macro_pending && state == STATE_IDLE && !runner.data) {
+
+        probe_macro_t *pmacro = macro_pending;
+
+        macro_pending = NULL;
+
+        if(macro_load(pmacro))
+            runner_start("macro", pmacro->data, NULL, NULL);
+    }
+}
+
+#endif
+
+#if PROBE_TUNE_ENABLE
+
+#define PROBE_TUNE_FEED_STEP 1.5f // feed rate multiplier between sweep steps
+
+// Reports the result for the current feed rate as [PRBTUNE:<feed rate>,<spread>,<overtravel>,<1 if ok else 0>].
+static bool tune_evaluate (void)
+{
+    bool ok = tune.count == tune.repeats && (tune.max - tune.min) <= probe_protect_settings.tune_tolerance &&
+               (probe_protect_settings.overtravel == 0.0f || tune.overtravel <= probe_protect_settings.overtravel);
+
+    hal.stream.write("[PRBTUNE:");
+    hal.stream.write(ftoa(tune.feed_rate, 1));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(tune.max - tune.min, 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(tune.overtravel, 3));
+    hal.stream.write(ok ? ",1]" ASCII_EOL : ",0]" ASCII_EOL);
+
+    return ok;
+}
+
+static bool tune_next_line (char *line)
+{
+    static const char axis_letter[] = "XYZ";
+
+    if(tune.done)
+        return false;
+
+    switch(tune.step) {
+
+        case TuneStep_Release:
+            tune.step = TuneStep_Retract;
+            sprintf(line, "G21G91G38.4%c%s", axis_letter[tune.axis], ftoa(-tune.distance, 3));
+            sprintf(strchr(line, '\0'), "F%s\n", ftoa(tune.start_feed_rate, 1));
+            return true;
+
+        case TuneStep_Retract:
+            tune.step = TuneStep_Probe;
+            sprintf(line, "G90G53G0%c%s\n", axis_letter[tune.axis], ftoa(tune.start, 3));
+            return true;
+
+        default:
+            break;
+    }
+
+    if(tune.count == tune.repeats) {
+        if(tune_evaluate()) {
+            tune.best_feed_rate = tune.feed_rate;
+            if(!(tune.done = tune.feed_rate >= tune.max_feed_rate))
+                tune.feed_rate = min(tune.feed_rate * PROBE_TUNE_FEED_STEP, tune.max_feed_rate);
+        } else
+            tune.done = true;
+        tune.count = 0;
+    }
+
+    if(tune.done)
+        modal_line(&tune.modal, line);
+    else {
+        tune.step = TuneStep_Release;
+        sprintf(line, "G21G91G38.2%c%s", axis_letter[tune.axis], ftoa(tune.distance, 3));
+        sprintf(strchr(line, '\0'), "F%s\n", ftoa(tune.feed_rate, 1));
+    }
+
+    return true;
+}
+
+static void tune_end (bool completed)
+{
+    char msg[70];
+
+    tune.active = false;
+
+    modal_restore(&tune.modal, completed);
+
+    if(!completed)
+        report_message("Probe tune: aborted", Message_Warning);
+    else if(tune.best_feed_rate == 0.0f)
+        report_message("Probe tune: no feed rate met the tolerance", Message_Warning);
+    else {
+        if(tune.store) {
+            settings.tool_change.feed_rate = tune.best_feed_rate;
+            settings_write_global();
+        }
+        strcpy(msg, "Probe tune: fastest feed rate meeting tolerance F");
+        strcat(msg, ftoa(tune.best_feed_rate, 1));
+        report_message(msg, Message_Info);
+    }
+}
+
+#endif
+
+#if PROBE_DIAMETER_ENABLE
+
+// For each spindle orientation: orient, then for each side of the toolsetter raise Z, move beside the toolsetter,
+// lower Z to the measuring depth, touch towards the center and back off. Finally return to the start position.
+static bool tooldia_next_line (char *line)
+{
+    uint_fast8_t n = tooldia.line++, orientation = n / PROBE_DIAMETER_LINES;
+    float feed_rate = settings.tool_change.feed_rate > 0.0f ? settings.tool_change.feed_rate : PROBE_DIAMETER_FEED,
+          zsafe = tooldia.start[Z_AXIS] + PROBE_DIAMETER_CLEARANCE;
+
+    if(orientation < tooldia.orientations) {
+
+        n %= PROBE_DIAMETER_LINES;
+
+        if(n == 0) {
+            if(tooldia.orientations > 1)
+                sprintf(line, "G21M19R%d\n", orientation ? 180 : 0);
+            else
+                strcpy(line, "G21\n");
+        } else {
+
+            float dir = (n - 1) / 5 ? -1.0f : 1.0f; // direction towards the toolsetter center
+
+            switch((n - 1) % 5) {
+
+                case 0:
+                    sprintf(line, "G90G53G0Z%s\n", ftoa(zsafe, 3));
+                    break;
+
+                case 1:
+                    sprintf(line, "G53G0X%s", ftoa(tooldia.center[0] - dir * (probe_protect_settings.setter_diameter / 2.0f + tooldia.radius + PROBE_DIAMETER_CLEARANCE), 3));
+                    sprintf(strchr(line, '\0'), "Y%s\n", ftoa(tooldia.center[1], 3));
+                    break;
+
+                case 2:
+                    sprintf(line, "G53G0Z%s\n", ftoa(tooldia.start[Z_AXIS] - tooldia.depth, 3));
+                    break;
+
+                case 3:
+                    tooldia.sample = true;
+                    sprintf(line, "G91G38.2X%s", ftoa(dir * (tooldia.radius + PROBE_DIAMETER_CLEARANCE), 3));
+                    sprintf(strchr(line, '\0'), "F%s\n", ftoa(feed_rate, 1));
+                    break;
+
+                default:
+                    sprintf(line, "G91G38.4X%s", ftoa(-dir * PROBE_DIAMETER_CLEARANCE, 3));
+                    sprintf(strchr(line, '\0'), "F%s\n", ftoa(feed_rate, 1));
+                    break;
+            }
+        }
+
+        return true;
+    }
+
+    switch(n - tooldia.orientations * PROBE_DIAMETER_LINES) {
+
+        case 0:
+            sprintf(line, "G90G53G0Z%s\n", ftoa(zsafe, 3));
+            break;
+
+        case 1:
+            sprintf(line, "G53G0X%s", ftoa(tooldia.start[X_AXIS], 3));
+            sprintf(strchr(line, '\0'), "Y%s\n", ftoa(tooldia.start[Y_AXIS], 3));
+            break;
+
+        case 2:
+            sprintf(line, "G53G0Z%s\n", ftoa(tooldia.start[Z_AXIS], 3));
+            break;
+
+        case 3:
+            modal_line(&tooldia.modal, line);
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+// Diameter is the distance between the tool center positions at contact on either side minus the toolsetter diameter,
+// runout is the shift of the midpoint between the two spindle orientations. Reported as [TOOLDIA:<tool>,<diameter>,<runout>].
+static void tooldia_end (bool completed)
+{
+    uint_fast8_t idx;
+    float diameter = 0.0f, runout = 0.0f;
+
+    tooldia.active = tooldia.sample = false;
+
+    modal_restore(&tooldia.modal, completed);
+
+    if(!completed || tooldia.touches != tooldia.orientations * 2) {
+        report_message("Probe tool diameter: measurement failed", Message_Warning);
+        return;
+    }
+
+    for(idx = 0; idx < tooldia.orientations; idx++)
+        diameter += tooldia.contact[idx][1] - tooldia.contact[idx][0] - probe_protect_settings.setter_diameter;
+
+    diameter /= (float)tooldia.orientations;
+
+    if(tooldia.orientations > 1)
+        runout = fabsf((tooldia.contact[0][0] + tooldia.contact[0][1]) - (tooldia.contact[1][0] + tooldia.contact[1][1])) / 2.0f;
+
+    if(tooldia.tool_id <= PROBE_TOOLS) {
+        tools[tooldia.tool_id].diameter = diameter + runout;
+        tools[tooldia.tool_id].runout = runout;
+    }
+
+    // the effective diameter is stored with the tool length in the tool table.
+    if(gc_state.tool && gc_state.tool->tool_id == tooldia.tool_id) {
+        gc_state.tool->radius = (diameter + runout) / 2.0f;
+#if N_TOOLS
+        settings_write_tool_data(gc_state.tool);
+#endif
+    }
+
+    hal.stream.write("[TOOLDIA:");
+    hal.stream.write(uitoa(tooldia.tool_id));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(diameter + runout, 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(runout, 4));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+#endif
+
+#if PROBE_POINTS_ENABLE
+
+// Distance below the start height to move to before probing: the approach standoff above the last contact
+// if the job is on a continuous surface and the probe is protected, 0 for no approach. Nearby points are expected
+// to be at about the same height. The approach is made at the highest feed rate that allows the machine to stop
+// within the stylus overtravel. Unlike a probe move it does not stop on contact, an unexpectedly high surface trips
+// protection and resets the controller: the job is aborted and machine position is lost, the stylus is not damaged.
+static float points_approach (void)
+{
+    float descent, from[N_AXIS] = {0}, to[N_AXIS] = {0};
+
+    if(!(points.job->approach && points.contacted && probe_protect_settings.approach_standoff > 0.0f && protection_armed))
+        return 0.0f;
+
+    descent = points.start[Z_AXIS] - (points.contact_z + probe_protect_settings.approach_standoff);
+
+    if(descent <= 0.0f || descent >= points.depth)
+        return 0.0f;
+
+    to[Z_AXIS] = -descent;
+
+    // no gain if not faster than probing.
+    return (points.approach_feed_rate = safe_feed_rate(from, to)) > points.feed_rate ? descent : 0.0f;
+}
+
+// The traverse, approach, probe, release and retract lines of a point are fed to the parser back to back, the rapids
+// are planned together and the release is queued as soon as the probe cycle completes. The retract rapid would trip
+// protection with the stylus still deflected. The next point is fetched from the job while the retract executes.
+static bool points_next_line (char *line)
+{
+    if(points.line == 0 && !points.done && !points.job->next(points.xy))
+        points.done = true;
+
+    if(!points.done) {
+
+        switch(points.line++) {
+
+            case 0:
+                sprintf(line, "G21G90G53G0X%s", ftoa(points.xy[0], 3));
+                sprintf(strchr(line, '\0'), "Y%s\n", ftoa(points.xy[1], 3));
+                break;
+
+            case 1:
+                if((points.descent = points_approach()) > 0.0f) {
+                    sprintf(line, "G53G1Z%s", ftoa(points.start[Z_AXIS] - points.descent, 3));
+                    sprintf(strchr(line, '\0'), "F%s\n", ftoa(points.approach_feed_rate, 1));
+                    break;
+                }
+                points.line++;
+                // fall through
+
+            case 2:
+                points.sample = true;
+                sprintf(line, "G91G38.2Z%s", ftoa(points.descent - points.depth, 3));
+                sprintf(strchr(line, '\0'), "F%s\n", ftoa(points.feed_rate, 1));
+                break;
+
+            case 3:
+                sprintf(line, "G91G38.4Z%s", ftoa(points.depth - points.descent, 3));
+                sprintf(strchr(line, '\0'), "F%s\n", ftoa(points.feed_rate, 1));
+                break;
+
+            default:
+                sprintf(line, "G90G53G0Z%s\n", ftoa(points.start[Z_AXIS], 3));
+                points.line = 0;
+                break;
+        }
+
+        return true;
+    }
+
+    switch(points.line++) {
+
+        case 0:
+            sprintf(line, "G21G90G53G0X%s", ftoa(points.start[X_AXIS], 3));
+            sprintf(strchr(line, '\0'), "Y%s\n", ftoa(points.start[Y_AXIS], 3));
+            break;
+
+        case 1:
+            modal_line(&points.modal, line);
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+static void points_end (bool completed)
+{
+    points.active = points.sample = false;
+
+    modal_restore(&points.modal, completed);
+
+    points.job->end(completed);
+}
+
+// Called from the M-code execute handler, the job starts at the current position.
+static void points_run (const probe_points_job_t *job, float depth, float feed_rate)
+{
+    protocol_buffer_synchronize();
+    system_convert_array_steps_to_mpos(points.start, sys.position);
+
+    points.depth = depth;
+    points.feed_rate = feed_rate;
+    modal_save(&points.modal);
+    points.line = 0;
+    points.done = points.sample = points.contacted = false;
+    points.job = job;
+
+    if((job->start == NULL || job->start()) && !(points.active = runner_start_mcode(job->name, points_next_line, points_end)))
+        job->end(false);
+}
+
+#endif
+
+#if PROBE_GRID_ENABLE
+
+static bool grid_next (float *xy)
+{
+    uint_fast16_t col, row;
+
+    if(grid.point == grid.columns * grid.rows)
+        return false;
+
+    points_serpentine(grid.point++, grid.columns, &col, &row);
+    xy[0] = points.start[X_AXIS] + grid.step[0] * (float)col;
+    xy[1] = points.start[Y_AXIS] + grid.step[1] * (float)row;
+
+    return true;
+}
+
+// Reports the plane as [GRID:<a>,<b>,<c>,<flatness>,<tilt>,<points>] where z = a * x + b * y + c, flatness is the
+// distance between the highest and lowest point relative to the plane and tilt is the plane angle in degrees.
+// Flatness is approximate, only the kept points are checked against the final plane.
+static void grid_end (bool completed)
+{
+    uint_fast8_t idx;
+    float deviation, dmin = 0.0f, dmax = 0.0f, tilt;
+    probe_fit_result_t result;
+
+    if(!completed || !probe_fit_solve(&grid.plane, &result)) {
+        report_message("Probe grid: failed", Message_Warning);
+        return;
+    }
+
+    for(idx = 0; idx < grid.n_candidates + (grid.unsolved ? 2 : 0); idx++) {
+        deviation = grid_deviation(&result, idx < grid.n_candidates ? &grid.candidate[idx] : (idx == grid.n_candidates ? &grid.low : &grid.high));
+        if(idx == 0 || deviation < dmin)
+            dmin = deviation;
+        if(idx == 0 || deviation > dmax)
+            dmax = deviation;
+    }
+
+    tilt = atanf(sqrtf(result.value[0] * result.value[0] + result.value[1] * result.value[1])) * 180.0f / M_PI;
+
+    hal.stream.write("[GRID:");
+    hal.stream.write(ftoa(result.value[0], 6));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(result.value[1], 6));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(result.value[2], 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(dmax - dmin, 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(tilt, 4));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(result.n));
+    hal.stream.write("]" ASCII_EOL);
+
+#if NGC_EXPRESSIONS_ENABLE
+    for(idx = 0; idx < 3; idx++)
+        ngc_param_set(PROBE_FIT_PARAM_BASE + idx, result.value[idx]);
+    ngc_param_set(PROBE_FIT_PARAM_BASE + 3, result.rms);
+    ngc_param_set(PROBE_FIT_PARAM_BASE + 4, (float)result.n);
+    ngc_param_set(PROBE_FIT_PARAM_BASE + 5, dmax - dmin);
+    ngc_param_set(PROBE_FIT_PARAM_BASE + 6, tilt);
+#endif
+}
+
+static const probe_points_job_t grid_job = {
+    .name = "grid",
+    .approach = true,
+    .next = grid_next,
+    .sample = grid_sample,
+    .end = grid_end
+};
+
+#endif
+
+#if PROBE_HEIGHTMAP_ENABLE
+
+static bool hmap_cached (float x, float y, float *z)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < hmap.n_cached; idx++) {
+        if(fabsf(hmap.cache[idx].x - x) < 0.001f && fabsf(hmap.cache[idx].y - y) < 0.001f) {
+            *z = hmap.cache[idx].z;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Second difference of the coarse grid heights at a node along X or Y, negative if the node has no neighbour on either side.
+static float hmap_d2 (uint_fast16_t col, uint_fast16_t row, bool along_x)
+{
+    uint_fast16_t idx = row * hmap.columns + col, stride = along_x ? 1 : hmap.columns;
+
+    if(along_x ? (col == 0 || col == hmap.columns - 1) : (row == 0 || row == hmap.rows - 1))
+        return -1.0f;
+
+    return fabsf(hmap.z[idx - stride] - 2.0f * hmap.z[idx] + hmap.z[idx + stride]);
+}
+
+// A coarse cell is refined if the second difference at any of its corners, taken over the neighbouring nodes,
+// exceeds the limit. Cells without neighbouring nodes along an axis, i.e. a grid of two columns or rows, are always refined.
+static bool hmap_coarse_refine (uint_fast16_t col, uint_fast16_t row, float limit)
+{
+    bool has_x = false, has_y = false;
+    uint_fast8_t idx;
+    float d2;
+
+    for(idx = 0; idx < 4; idx++) {
+        if((d2 = hmap_d2(col + idx % 2, row + idx / 2, true)) >= 0.0f) {
+            if(d2 > limit)
+                return true;
+            has_x = true;
+        }
+        if((d2 = hmap_d2(col + idx % 2, row + idx / 2, false)) >= 0.0f) {
+            if(d2 > limit)
+                return true;
+            has_y = true;
+        }
+    }
+
+    return !(has_x && has_y);
+}
+
+// A quarter of a split cell is refined if a second difference along one of its edges through the 3 x 3 heights
+// of the parent exceeds the limit. slot is the lower left corner of the quarter in the parent.
+static bool hmap_child_refine (const float *z, uint_fast8_t slot, float limit)
+{
+    uint_fast8_t idx, row = slot / 3, col = slot % 3;
+
+    for(idx = 0; idx < 2; idx++) {
+        if(fabsf(z[(row + idx) * 3] - 2.0f * z[(row + idx) * 3 + 1] + z[(row + idx) * 3 + 2]) > limit ||
+            fabsf(z[col + idx] - 2.0f * z[3 + col + idx] + z[6 + col + idx]) > limit)
+            return true;
+    }
+
+    return false;
+}
+
+// Sets the next point to probe, false when done. The coarse grid is probed first, then each coarse cell in turn
+// is refined if the surface curves too much to be interpolated bilinearly from its corners: the interpolation error
+// at an edge midpoint is an eighth of the second difference along the edge, which is estimated from the coarse grid
+// without probing. A refined cell gets its center and edge midpoints probed and is split in four, each quarter is
+// refined the same way from the second differences of the 3 x 3 heights of its parent.
+// Both the coarse grid and the coarse cells are visited in serpentine order.
+static bool hmap_next (float *xy)
+{
+    uint_fast8_t idx, slot;
+    uint_fast16_t row, col;
+    float limit = hmap.tolerance * 8.0f;
+    hmap_cell_t *cell, parent;
+
+    if(hmap.node < hmap.columns * hmap.rows) {
+        points_serpentine(hmap.node, hmap.columns, &col, &row);
+        xy[0] = points.start[X_AXIS] + hmap.step[0] * (float)col;
+        xy[1] = points.start[Y_AXIS] + hmap.step[1] * (float)row;
+        return true;
+    }
+
+    while(true) {
+
+        if(hmap.n_cells == 0) {
+
+            do {
+                if(hmap.cell == (hmap.columns - 1) * (hmap.rows - 1))
+                    return false;
+                points_serpentine(hmap.cell++, hmap.columns - 1, &col, &row);
+            } while(hmap.levels == 0 || !hmap_coarse_refine(col, row, limit));
+
+            cell = &hmap.cells[hmap.n_cells++];
+            cell->x = points.start[X_AXIS] + hmap.step[0] * (float)col;
+            cell->y = points.start[Y_AXIS] + hmap.step[1] * (float)row;
+            cell->width = hmap.step[0];
+            cell->height = hmap.step[1];
+            cell->z[0] = hmap.z[row * hmap.columns + col];
+            cell->z[2] = hmap.z[row * hmap.columns + col + 1];
+            cell->z[6] = hmap.z[(row + 1) * hmap.columns + col];
+            cell->z[8] = hmap.z[(row + 1) * hmap.columns + col + 1];
+            cell->level = cell->stage = 0;
+        }
+
+        cell = &hmap.cells[hmap.n_cells - 1];
+
+        if(cell->stage == 5) {
+            parent = *cell;
+            hmap.n_cells--;
+            if(parent.level + 1 > hmap.level_max)
+                hmap.level_max = parent.level + 1;
+            if(parent.level + 1 < hmap.levels) {
+                for(idx = 0; idx < 4; idx++) {
+                    slot = (idx / 2) * 3 + idx % 2; // lower left corner in the parent
+                    if(!hmap_child_refine(parent.z, slot, limit))
+                        continue;
+                    cell = &hmap.cells[hmap.n_cells++];
+                    cell->x = parent.x + parent.width * 0.5f * (float)(idx % 2);
+                    cell->y = parent.y + parent.height * 0.5f * (float)(idx / 2);
+                    cell->width = parent.width * 0.5f;
+                    cell->height = parent.height * 0.5f;
+                    cell->z[0] = parent.z[slot];
+                    cell->z[2] = parent.z[slot + 1];
+                    cell->z[6] = parent.z[slot + 3];
+                    cell->z[8] = parent.z[slot + 4];
+                    cell->level = parent.level + 1;
+                    cell->stage = 0;
+                }
+            }
+        } else { // center or edge midpoint
+            slot = hmap_slot(cell);
+            xy[0] = cell->x + cell->width * 0.5f * (float)(slot % 3);
+            xy[1] = cell->y + cell->height * 0.5f * (float)(slot / 3);
+            if(!hmap_cached(xy[0], xy[1], &cell->z[slot]))
+                return true;
+            cell->stage++;
+        }
+    }
+}
+
+// Reports [HMAPEND:<points>,<full grid points>] where full grid points is the number of points
+// a uniform grid at the finest resolution used would have needed.
+static void hmap_end (bool completed)
+{
+    if(!completed) {
+        report_message("Probe heightmap: failed", Message_Warning);
+        return;
+    }
+
+    hal.stream.write("[HMAPEND:");
+    hal.stream.write(uitoa(hmap.points));
+    hal.stream.write(",");
+    hal.stream.write(uitoa((((hmap.columns - 1) << hmap.level_max) + 1) * (((hmap.rows - 1) << hmap.level_max) + 1)));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+static const probe_points_job_t hmap_job = {
+    .name = "heightmap",
+    .approach = true,
+    .next = hmap_next,
+    .sample = hmap_sample,
+    .end = hmap_end
+};
+
+#endif
+
+#if PROBE_POINT_LIST_SIZE
+
+static float point_distance (const float *a, const float *b)
+{
+    return sqrtf((a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]));
+}
+
+// XY travel from the start position through the points in the given order.
+static float point_list_travel (const float *start, const uint8_t *order)
+{
+    uint_fast8_t idx;
+    float travel = 0.0f;
+
+    for(idx = 0; idx < point_list.n_points; idx++)
+        travel += point_distance(idx ? point_list.xy[order[idx - 1]] : start, point_list.xy[order[idx]]);
+
+    return travel;
+}
+
+// Orders the points by nearest neighbour from the start position and improves the path by 2-opt:
+// a segment is reversed when that shortens the path, until no reversal helps or the pass limit is reached.
+// The path is open, it ends at the last point.
+static void point_list_order (const float *start)
+{
+    bool improved = true;
+    uint_fast8_t idx, i, j, best, tmp, passes = 0, n = point_list.n_points;
+    float d, dmin, delta;
+    const float *prev, *next;
+
+    for(idx = 0; idx < n; idx++)
+        point_list.order[idx] = idx;
+
+    point_list.travel_added = point_list_travel(start, point_list.order);
+
+    for(idx = 0; idx < n; idx++) {
+        prev = idx ? point_list.xy[point_list.order[idx - 1]] : start;
+        best = idx;
+        dmin = 0.0f;
+        for(j = idx; j < n; j++) {
+            d = point_distance(prev, point_list.xy[point_list.order[j]]);
+            if(j == idx || d < dmin) {
+                dmin = d;
+                best = j;
+            }
+        }
+        tmp = point_list.order[idx];
+        point_list.order[idx] = point_list.order[best];
+        point_list.order[best] = tmp;
+    }
+
+    while(improved && passes++ < PROBE_POINT_LIST_PASSES) {
+        improved = false;
+        for(i = 0; i + 1 < n; i++) {
+            prev = i ? point_list.xy[point_list.order[i - 1]] : start;
+            for(j = i + 1; j < n; j++) {
+                next = j + 1 < n ? point_list.xy[point_list.order[j + 1]] : NULL;
+                delta = point_distance(prev, point_list.xy[point_list.order[j]]) - point_distance(prev, point_list.xy[point_list.order[i]]);
+                if(next)
+                    delta += point_distance(point_list.xy[point_list.order[i]], next) - point_distance(point_list.xy[point_list.order[j]], next);
+                if(delta < -0.001f) {
+                    for(idx = 0; idx < (j - i + 1) / 2; idx++) {
+                        tmp = point_list.order[i + idx];
+                        point_list.order[i + idx] = point_list.order[j - idx];
+                        point_list.order[j - idx] = tmp;
+                    }
+                    improved = true;
+                }
+            }
+        }
+    }
+
+    point_list.travel = point_list_travel(start, point_list.order);
+    point_list.next = 0;
+}
+
+static bool point_list_start (void)
+{
+    point_list_order(points.start);
+
+    return true;
+}
+
+static bool point_list_next (float *xy)
+{
+    if(point_list.next == point_list.n_points)
+        return false;
+
+    memcpy(xy, point_list.xy[point_list.order[point_list.next++]], sizeof(float) * 2);
+
+    return true;
+}
+
+// Reports [PNTEND:<points>,<travel>,<travel in the order added>], travel is the XY distance in mm from the start position to the last point.
+static void point_list_end (bool completed)
+{
+    if(!completed) {
+        report_message("Probe point list: failed", Message_Warning);
+        return;
+    }
+
+    hal.stream.write("[PNTEND:");
+    hal.stream.write(uitoa(point_list.next));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(point_list.travel, 1));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(point_list.travel_added, 1));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+static const probe_points_job_t point_list_job = {
+    .name = "point list",
+    .start = point_list_start,
+    .next = point_list_next,
+    .sample = point_list_sample,
+    .end = point_list_end
+};
+
+#endif
+
+#if PROBE_POINT_FILE_ENABLE
+
+static bool point_file_start (void)
+{
+    char filename[32];
+
+    point_file.head = point_file.tail = 0;
+    point_file.line = point_file.points = 0;
+    point_file.eof = point_file.error = false;
+    point_file.out = NULL;
+
+    sprintf(filename, PROBE_POINT_FILE_IN, point_file.file_no);
+    if((point_file.in = vfs_open(filename, "r")) == NULL) {
+        report_message("Probe point file: failed to open input file", Message_Warning);
+        return false;
+    }
+
+    sprintf(filename, PROBE_POINT_FILE_OUT, point_file.file_no);
+    if((point_file.out = vfs_open(filename, "w")) == NULL) {
+        vfs_close(point_file.in);
+        report_message("Probe point file: failed to open output file", Message_Warning);
+        return false;
+    }
+
+    return true;
+}
+
+// Returns the next line from the buffer with whitespace removed, refilling it from the file as needed. NULL at the end of the file
+// or if a line does not fit in the buffer.
+static char *point_file_getline (void)
+{
+    char *line, *eol, *s1, *s2;
+    size_t len, n;
+
+    while(true) {
+
+        len = point_file.tail - point_file.head;
+        line = point_file.buffer + point_file.head;
+
+        if((eol = memchr(line, '\n', len))) {
+            *eol = '\0';
+            point_file.head += eol - line + 1;
+            break;
+        }
+
+        if(point_file.eof) {
+            if(len == 0)
+                return NULL;
+            point_file.buffer[point_file.tail] = '\0'; // last line without line terminator
+            point_file.head = point_file.tail;
+            break;
+        }
+
+        if(len == PROBE_POINT_FILE_BUFFER) { // line too long
+            point_file.line++;
+            point_file.error = true;
+            return NULL;
+        }
+
+        memmove(point_file.buffer, line, len);
+        point_file.head = 0;
+        n = vfs_read(point_file.buffer + len, 1, PROBE_POINT_FILE_BUFFER - len, point_file.in);
+        point_file.tail = len + n;
+        point_file.eof = n < PROBE_POINT_FILE_BUFFER - len;
+    }
+
+    for(s1 = s2 = line; *s1; s1++) {
+        if(!(*s1 == ' ' || *s1 == '\t' || *s1 == '\r'))
+            *s2++ = *s1;
+    }
+    *s2 = '\0';
+
+    return line;
+}
+
+// Empty lines and lines starting with ; or ( are skipped, any other line must be <x>,<y>.
+static bool point_file_next (float *xy)
+{
+    char *line;
+    float x, y;
+    uint_fast8_t cc;
+
+    while((line = point_file_getline())) {
+
+        point_file.line++;
+
+        if(*line == '\0' || *line == ';' || *line == '(')
+            continue;
+
+        cc = 0;
+        if(!read_float(line, &cc, &x) || line[cc++] != ',' || !read_float(line, &cc, &y) || line[cc] != '\0') {
+            point_file.error = true;
+            return false;
         }
-        hal.delay_ms(RELAY_DEBOUNCE, NULL); // Delay a bit to let any contact bounce settle.
-    } else{
-        //restore settings (not sure if needed)
-        //settings.probe.invert_probe_pin = nvs_invert_probe_pin;
-        //hal.limits.enable(settings.limits.flags.hard_enabled, (axes_signals_t){0});  //restore hard limit settings.
+
+        xy[0] = x * point_file.scale + point_file.offset[0];
+        xy[1] = y * point_file.scale + point_file.offset[1];
+
+        return true;
     }
 
-    if(on_probe_fixture)
-        status = on_probe_fixture(tool, at_g59_3, on);
+    return false;
+}
 
-    return status;
+// Writes the trigger position as <x>,<y>,<z> in work coordinates to the output file.
+static void point_file_sample (float *position)
+{
+    char result[48];
+
+    sprintf(result, "%s,", ftoa(position[X_AXIS], 4));
+    sprintf(strchr(result, '\0'), "%s,", ftoa(position[Y_AXIS], 4));
+    sprintf(strchr(result, '\0'), "%s\n", ftoa(position[Z_AXIS], 4));
+    vfs_write(result, 1, strlen(result), point_file.out);
+
+    if(point_file.points++ == 0)
+        point_file.z_min = point_file.z_max = position[Z_AXIS];
+    else {
+        point_file.z_min = min(point_file.z_min, position[Z_AXIS]);
+        point_file.z_max = max(point_file.z_max, position[Z_AXIS]);
+    }
+}
+
+// Reports [PNTFILE:<points>,<min z>,<max z>], the points are in the output file.
+static void point_file_end (bool completed)
+{
+    char msg[48];
+
+    vfs_close(point_file.in);
+    vfs_close(point_file.out);
+
+    if(point_file.error) {
+        sprintf(msg, "Probe point file: bad line %u", (unsigned int)point_file.line);
+        report_message(msg, Message_Warning);
+    } else if(!completed)
+        report_message("Probe point file: failed", Message_Warning);
+    else {
+        hal.stream.write("[PNTFILE:");
+        hal.stream.write(uitoa(point_file.points));
+        hal.stream.write(",");
+        hal.stream.write(ftoa(point_file.z_min, 4));
+        hal.stream.write(",");
+        hal.stream.write(ftoa(point_file.z_max, 4));
+        hal.stream.write("]" ASCII_EOL);
+    }
 }
 
+static const probe_points_job_t point_file_job = {
+    .name = "point file",
+    .start = point_file_start,
+    .next = point_file_next,
+    .sample = point_file_sample,
+    .end = point_file_end
+};
+
+#endif
+
 static void on_probe_connected_toggle(void){
-    
-    int val = 0;
-    //if there is a pin, read it
-    if(probe_protect_settings.flags.ext_pin){
-        //hal.delay_ms(RELAY_DEBOUNCE, NULL); // Delay a bit to let any contact bounce settle.
-        val = hal.port.wait_on_input(Port_Digital, probe_connect_port, WaitMode_Immediate, 0.0f);//read the IO pin        
-        if(val == 1)
-            probe_connected.ext_pin = true;
-        else
-            probe_connected.ext_pin = false;
 
-        if(probe_protect_settings.flags.ext_pin_inv)
-            probe_connected.ext_pin = !probe_connected.ext_pin;
-    }
+    //snapshot of the connected state, the external pin level has already been sampled by the interrupt handler.
+    probe_connected_flags_t connected = connected_get();
 
-    
-    if(probe_connected.ext_pin)
+#if PROBE_TRACE_SIZE
+    trace_add(ProbeTrace_Connected, connected.value, 0.0f, NULL);
+#endif
+
+    if(connected.ext_pin)
         report_message("External Probe connected!", Message_Info);    
 
-    if (probe_connected.t99)
+    if (connected.t99)
         report_message("T99 Probe connected!", Message_Info);
 
-    if(probe_connected.mcode)
+    if(connected.mcode)
             report_message("Mcode Probe connected!", Message_Info);
 
-    if(probe_connected.toggle)
+    if(connected.toggle)
             report_message("Probe connect toggled on", Message_Info);
 
     
-    if(probe_connected.value)
+    if(connected.value)
         protection_on();
     else{
         protection_off();
         report_message("Probe disconnected, protection off.", Message_Info);
     }
 
+    if(connected_published != !!connected.value) {
+        connected_published = !!connected.value;
+        publish(connected_published ? ProbeEvent_Connected : ProbeEvent_Disconnected, false, sys.position);
+#if PROBE_MACROS_ENABLE
+        if(connected_published ? probe_protect_settings.options.connect_macro : probe_protect_settings.options.disconnect_macro)
+            macro_pending = &macros[connected_published ? 0 : 1];
+#endif
+    }
+
     probe_state_t probe = hal.probe.get_state();
 
     if(!probe.connected) {
@@ -306,7 +3086,7 @@ static void on_probe_connected_toggle(void){
 static void onSpindleSetState (spindle_state_t state, float rpm)
 {
     //If the probe is connected and the spindle is turning on, alarm.
-    if(probe_connected.value && (state.value !=0)){
+    if(probe_connected && (state.value !=0)){
         state.value = 0; //ensure spindle is off
         grbl.enqueue_realtime_command(CMD_RESET);
         report_message("PROBE IS IN SPINDLE!", Message_Warning);
@@ -316,9 +3096,11 @@ static void onSpindleSetState (spindle_state_t state, float rpm)
 }
 
 static bool onSpindleSelect (spindle_ptrs_t *spindle)
-{   
-    on_spindle_set_state = spindle->set_state;
-    spindle->set_state = onSpindleSetState;
+{
+    if(spindle->set_state != onSpindleSetState) { // do not wrap ourselves if the same spindle is selected again.
+        on_spindle_set_state = spindle->set_state;
+        spindle->set_state = onSpindleSetState;
+    }
 
     return on_spindle_select == NULL || on_spindle_select(spindle);
 }
@@ -328,27 +3110,120 @@ static void onToolSelected (tool_data_t *tool)
     //if the tool is 99, set probe connected.
     current_tool = tool;
 
-    if (tool->tool_id == 99)
-        probe_connected.t99 = true;
-    else
-        probe_connected.t99 = false;
-    
+#if PROBE_TRACE_SIZE
+    trace_add_tool(tool->tool_id);
+#endif
+
+    connected_set(PROBE_CONNECTED_T99, tool->tool_id == 99);
+
+#if PROBE_TOOL_CHECK_ENABLE
+    if(probe_protect_settings.options.tool_check && tool->tool_id <= PROBE_TOOLS && tools[tool->tool_id].measured)
+        report_message("Tool measured since reset, quick check only", Message_Info);
+#endif
+
     on_probe_connected_toggle();
 
     if(on_tool_selected)
         on_tool_selected(tool);
 }
 
+// Rebuilds the probe connected state from its sources: connected pin level, current tool and
+// last M401/M402 (restored from NVS after a power cycle if enabled). Run after startup and reset
+// so protection is never left armed with no probe fitted or disarmed when one is.
+static void connected_reconcile (uint_fast16_t state)
+{
+    tool_data_t *tool = current_tool ? current_tool : gc_state.tool;
+    uint_fast16_t connected = probe_connected & PROBE_CONNECTED_MCODE;
+
+    if(ext_pin_ok && (hal.port.wait_on_input(Port_Digital, probe_connect_port, WaitMode_Immediate, 0.0f) == 1) != probe_protect_settings.flags.ext_pin_inv)
+        connected |= PROBE_CONNECTED_EXT_PIN;
+
+    if(tool && tool->tool_id == 99)
+        connected |= PROBE_CONNECTED_T99;
+
+    if(connected != probe_connected || protection_armed != !!connected) {
+        connected_set(~connected & 0xFF, false);
+        connected_set(connected, true);
+        on_probe_connected_toggle();
+    }
+}
+
+static void mcode_save (bool on)
+{
+    if(nvs_ext_address && probe_protect_settings.options.keep_mcode && probe_protect_settings.mcode_connected != on) {
+        probe_protect_settings.mcode_connected = on;
+        hal.nvs.memcpy_to_nvs(nvs_ext_address, (uint8_t *)&probe_protect_settings.version, PROBE_SETTINGS_EXT_SIZE, true);
+    }
+}
+
+#if PROBE_FIT_ENABLE
+
+// Reports the result as [FIT:<type>,<value 0>,<value 1>,<value 2>,<rms>,<points>], values are
+// x, y, radius for a circle, a, b, c of z = a * x + b * y + c for a plane and x, y, angle for a line.
+static void fit_report (probe_fit_t *pfit)
+{
+    static const char *names[] = { "", "CIRCLE", "PLANE", "LINE" };
+
+    uint_fast8_t idx;
+    probe_fit_result_t result;
+
+    if(!probe_fit_solve(pfit, &result)) {
+        report_message("Probe fit: too few or degenerate points", Message_Warning);
+        return;
+    }
+
+    hal.stream.write("[FIT:");
+    hal.stream.write(names[result.type]);
+    for(idx = 0; idx < 3; idx++) {
+        hal.stream.write(",");
+        hal.stream.write(ftoa(result.value[idx], result.type == ProbeFit_Plane && idx < 2 ? 6 : 4));
+    }
+    hal.stream.write(",");
+    hal.stream.write(ftoa(result.rms, 4));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(result.n));
+    hal.stream.write("]" ASCII_EOL);
+
+#if NGC_EXPRESSIONS_ENABLE
+    for(idx = 0; idx < 3; idx++)
+        ngc_param_set(PROBE_FIT_PARAM_BASE + idx, result.value[idx]);
+    ngc_param_set(PROBE_FIT_PARAM_BASE + 3, result.rms);
+    ngc_param_set(PROBE_FIT_PARAM_BASE + 4, (float)result.n);
+#endif
+}
+
+#endif
+
+static void onExecuteRealtime (sys_state_t state)
+{
+    on_execute_realtime(state);
+
+#if PROBE_MACROS_ENABLE
+    macro_poll(state);
+#endif
+
+#if PROBE_SCAN_SIZE
+    if(scan.active)
+        scan_report(false);
+#endif
+}
+
 static void mcode_execute (uint_fast16_t state, parser_block_t *gc_block)
 {
     bool handled = true;
 
+#if PROBE_TRACE_SIZE
+    if(state != STATE_CHECK_MODE && (gc_block->user_mcode == (user_mcode_t)401 || gc_block->user_mcode == (user_mcode_t)402))
+        trace_add(ProbeTrace_MCode, (uint8_t)(gc_block->user_mcode - 400), 0.0f, NULL);
+#endif
+
     if (state != STATE_CHECK_MODE)
       switch((uint16_t)gc_block->user_mcode) {
 
         case 401:
-            if(!probe_connected.mcode){
-                probe_connected.mcode = true;
+            if(!(probe_connected & PROBE_CONNECTED_MCODE)){
+                connected_set(PROBE_CONNECTED_MCODE, true);
+                mcode_save(true);
                 //enqueue probe connected symbol.
                 grbl.enqueue_realtime_command(CMD_PROBE_CONNECTED_TOGGLE);
                 hal.delay_ms(RELAY_DEBOUNCE, NULL); // Delay a bit to let any contact bounce settle.
@@ -356,9 +3231,218 @@ static void mcode_execute (uint_fast16_t state, parser_block_t *gc_block)
                 report_message("Probe connected signal already asserted!", Message_Warning);
             break;
 
+        case 403:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+
+                probe_zero.armed = true;
+                probe_zero.id = mcode_words.p ? (coord_system_id_t)(gc_block->values.p - 1.0f) : gc_state.modal.coord_system.id;
+                probe_zero.radius = mcode_words.r ? gc_block->values.r * scale : probe_protect_settings.tip_radius;
+                probe_zero.axes.value = 0;
+                memset(probe_zero.value, 0, sizeof(probe_zero.value));
+                if(mcode_words.i) {
+                    probe_zero.axes.x = On;
+                    probe_zero.value[X_AXIS] = gc_block->values.ijk[X_AXIS] * scale;
+                }
+                if(mcode_words.j) {
+                    probe_zero.axes.y = On;
+                    probe_zero.value[Y_AXIS] = gc_block->values.ijk[Y_AXIS] * scale;
+                }
+                if(mcode_words.k) {
+                    probe_zero.axes.z = On;
+                    probe_zero.value[Z_AXIS] = gc_block->values.ijk[Z_AXIS] * scale;
+                }
+            }
+            break;
+
+#if PROBE_POINT_CACHE_SIZE
+        case 405:
+            point_cache.tagged = true;
+            point_cache.point_id = (uint16_t)gc_block->values.p;
+            break;
+#endif
+
+#if PROBE_TUNE_ENABLE
+        case 406:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f, start[N_AXIS], target[N_AXIS];
+
+                protocol_buffer_synchronize(); // sweep starts from the current position.
+                system_convert_array_steps_to_mpos(start, sys.position);
+
+                tune.axis = mcode_words.i ? X_AXIS : (mcode_words.j ? Y_AXIS : Z_AXIS);
+                tune.start = start[tune.axis];
+                tune.distance = gc_block->values.ijk[tune.axis] * scale;
+                tune.start_feed_rate = tune.feed_rate = mcode_words.e ? gc_block->values.e * scale : PROBE_TUNE_START_FEED;
+                tune.max_feed_rate = gc_block->values.q * scale;
+                tune.repeats = mcode_words.l ? (uint_fast8_t)gc_block->values.l : 5;
+                tune.store = mcode_words.s && gc_block->values.s == 1.0f;
+                modal_save(&tune.modal);
+                tune.best_feed_rate = 0.0f;
+                tune.count = 0;
+                tune.step = TuneStep_Probe;
+                tune.done = false;
+
+                // feed rates above the safe limit would be clamped by probe_start(), there is no point in testing them.
+                if(probe_protect_settings.overtravel > 0.0f) {
+                    memcpy(target, start, sizeof(target));
+                    target[tune.axis] += tune.distance;
+                    float feed_rate = safe_feed_rate(start, target);
+                    if(feed_rate > 0.0f && feed_rate < tune.max_feed_rate)
+                        tune.max_feed_rate = feed_rate;
+                }
+
+                tune.active = runner_start_mcode("tune", tune_next_line, tune_end);
+            }
+            break;
+#endif
+
+#if PROBE_DIAMETER_ENABLE
+        case 407:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f, g59_3[N_AXIS];
+
+                protocol_buffer_synchronize(); // measurement depth is relative to the current position.
+
+                if(!settings_read_coord_data(CoordinateSystem_G59_3, &g59_3)) {
+                    report_message("Probe tool diameter: toolsetter position not set", Message_Warning);
+                    break;
+                }
+
+                system_convert_array_steps_to_mpos(tooldia.start, sys.position);
+                tooldia.center[0] = g59_3[X_AXIS];
+                tooldia.center[1] = g59_3[Y_AXIS];
+                tooldia.radius = gc_block->values.d * scale / 2.0f;
+                tooldia.depth = mcode_words.k ? gc_block->values.ijk[Z_AXIS] * scale : PROBE_DIAMETER_CLEARANCE;
+                tooldia.orientations = mcode_words.p && gc_block->values.p == 0.0f ? 1 : 2;
+                tooldia.tool_id = gc_state.tool ? gc_state.tool->tool_id : 0;
+                modal_save(&tooldia.modal);
+                tooldia.line = tooldia.touches = 0;
+                tooldia.sample = false;
+                tooldia.active = runner_start_mcode("tool diameter", tooldia_next_line, tooldia_end);
+            }
+            break;
+#endif
+
+#if PROBE_TOOL_CHECK_ENABLE
+        case 408:
+            tool_check_clear(mcode_words.p ? (int32_t)gc_block->values.p : -1);
+            break;
+#endif
+
+#if PROBE_TOOL_PARAMS_ENABLE
+        case 409:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+                probe_tool_params_t *params = &tool_params[(uint32_t)gc_block->values.p];
+
+                // P only clears the entry.
+                memset(params, 0, sizeof(probe_tool_params_t));
+                if(mcode_words.d)
+                    params->seek_rate = (uint16_t)lroundf(gc_block->values.d * scale);
+                if(mcode_words.e)
+                    params->feed_rate = (uint16_t)lroundf(gc_block->values.e * scale);
+                if(mcode_words.r)
+                    params->pulloff_rate = (uint16_t)lroundf(gc_block->values.r * scale);
+                if(mcode_words.k)
+                    params->length = gc_block->values.ijk[Z_AXIS] * scale;
+                if(mcode_words.q)
+                    params->tolerance = (uint16_t)lroundf(gc_block->values.q * scale * 1000.0f);
+
+                hal.nvs.memcpy_to_nvs(tool_params_address, (uint8_t *)tool_params, sizeof(tool_params), true);
+            }
+            break;
+#endif
+
+#if PROBE_FIT_ENABLE
+        case 410:
+            if(mcode_words.p && gc_block->values.p != 0.0f)
+                probe_fit_init(&fit, (probe_fit_type_t)gc_block->values.p);
+            else if(fit.type != ProbeFit_None) {
+                fit_report(&fit);
+                fit.type = ProbeFit_None;
+            }
+            break;
+#endif
+
+#if PROBE_GRID_ENABLE
+        case 411:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+
+                grid.columns = (uint_fast16_t)gc_block->values.p;
+                grid.rows = (uint_fast16_t)gc_block->values.q;
+                grid.step[0] = gc_block->values.ijk[X_AXIS] * scale / (float)(grid.columns - 1);
+                grid.step[1] = gc_block->values.ijk[Y_AXIS] * scale / (float)(grid.rows - 1);
+                grid.point = 0;
+                grid.n_candidates = 0;
+                grid.unsolved = false;
+                probe_fit_init(&grid.plane, ProbeFit_Plane);
+                points_run(&grid_job, gc_block->values.ijk[Z_AXIS] * scale, mcode_words.e ? gc_block->values.e * scale : PROBE_POINTS_FEED);
+            }
+            break;
+#endif
+
+#if PROBE_HEIGHTMAP_ENABLE
+        case 412:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+
+                hmap.columns = (uint_fast16_t)gc_block->values.p;
+                hmap.rows = (uint_fast16_t)gc_block->values.q;
+                hmap.step[0] = gc_block->values.ijk[X_AXIS] * scale / (float)(hmap.columns - 1);
+                hmap.step[1] = gc_block->values.ijk[Y_AXIS] * scale / (float)(hmap.rows - 1);
+                hmap.tolerance = gc_block->values.r;
+                hmap.levels = mcode_words.l ? gc_block->values.l : 2;
+                hmap.level_max = hmap.n_cells = hmap.n_cached = hmap.cache_head = 0;
+                hmap.node = hmap.cell = 0;
+                hmap.points = 0;
+                points_run(&hmap_job, gc_block->values.ijk[Z_AXIS] * scale, mcode_words.e ? gc_block->values.e * scale : PROBE_POINTS_FEED);
+            }
+            break;
+#endif
+
+#if PROBE_POINT_LIST_SIZE
+        case 413:
+            {
+                float scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+
+                if(mcode_words.i) {
+                    float *xy = point_list.xy[point_list.n_points++];
+                    xy[0] = gc_block->values.ijk[X_AXIS] * scale + gc_state.modal.coord_system.xyz[X_AXIS] + gc_state.g92_coord_offset[X_AXIS] + gc_state.tool_length_offset[X_AXIS];
+                    xy[1] = gc_block->values.ijk[Y_AXIS] * scale + gc_state.modal.coord_system.xyz[Y_AXIS] + gc_state.g92_coord_offset[Y_AXIS] + gc_state.tool_length_offset[Y_AXIS];
+                } else if(mcode_words.k) {
+                    points_run(&point_list_job, gc_block->values.ijk[Z_AXIS] * scale, mcode_words.e ? gc_block->values.e * scale : PROBE_POINTS_FEED);
+                } else
+                    point_list.n_points = 0;
+            }
+            break;
+#endif
+
+#if PROBE_POINT_FILE_ENABLE
+        case 414:
+            point_file.file_no = mcode_words.p ? (uint8_t)gc_block->values.p : 0;
+            point_file.scale = gc_state.modal.units_imperial ? 25.4f : 1.0f;
+            point_file.offset[0] = gc_state.modal.coord_system.xyz[X_AXIS] + gc_state.g92_coord_offset[X_AXIS] + gc_state.tool_length_offset[X_AXIS];
+            point_file.offset[1] = gc_state.modal.coord_system.xyz[Y_AXIS] + gc_state.g92_coord_offset[Y_AXIS] + gc_state.tool_length_offset[Y_AXIS];
+            points_run(&point_file_job, gc_block->values.ijk[Z_AXIS] * point_file.scale, mcode_words.e ? gc_block->values.e * point_file.scale : PROBE_POINTS_FEED);
+            break;
+#endif
+
+#if PROBE_SCAN_SIZE
+        case 404:
+            protocol_buffer_synchronize(); // start and stop scanning in sync with motion.
+            if(gc_block->values.p == 1.0f)
+                scan_start();
+            else
+                scan_stop();
+            break;
+#endif
+
         case 402:
-            if(probe_connected.mcode){
-                probe_connected.mcode = false;
+            if(probe_connected & PROBE_CONNECTED_MCODE){
+                connected_set(PROBE_CONNECTED_MCODE, false);
+                mcode_save(false);
                 //enqueue probe disconnected symbol.
                 grbl.enqueue_realtime_command(CMD_PROBE_CONNECTED_TOGGLE);
                 hal.delay_ms(RELAY_DEBOUNCE, NULL); // Delay a bit to let any contact bounce settle.
@@ -379,8 +3463,36 @@ static void probe_reset (void)
 {
     settings.probe.invert_probe_pin = nvs_invert_probe_pin;
     hal.limits.enable(settings.limits.flags.hard_enabled, (axes_signals_t){0});  //restore hard limit settings.
-    //probe_connected.value = 0;  //seems like it is best for this to survive reset.
+    //probe_connected = 0;  //seems like it is best for this to survive reset.
+    probe_zero.armed = false;
+    overtravel_limit_reported = false;
+#if PROBE_SCAN_SIZE
+    scan.active = false;
+#endif
+#if PROBE_POINT_CACHE_SIZE
+    point_cache.tagged = false;
+#endif
+    protection_tripped = false;
+#if PROBE_TRACE_SIZE
+    trace_add(ProbeTrace_Reset, (uint8_t)probe_connected, 0.0f, NULL);
+#endif
+    runner_end(false);
+#if PROBE_MACROS_ENABLE
+    macro_pending = NULL;
+#endif
+#if PROBE_TOOL_CHECK_ENABLE
+    fixture_tool = NULL;
+    tool_check_clear(-1);
+#endif
+#if PROBE_TOOL_PARAMS_ENABLE
+    tool_params_restore();
+#endif
+#if PROBE_FIT_ENABLE
+    fit.type = ProbeFit_None;
+#endif
     driver_reset();
+
+    protocol_enqueue_rt_command(connected_reconcile);
 }
 
 static void report_options (bool newopt)
@@ -394,6 +3506,370 @@ static void report_options (bool newopt)
 
 }
 
+#if PROBE_PROTECT_DEBUG
+
+static status_code_t report_hook_debug (sys_state_t state, char *args)
+{
+    char buf[100];
+
+    hook_chain_check("$PROBEHOOKS");
+
+    sprintf(buf, "[PROBEHOOKS:%s|%s|%s|%lu|%u|%lu|%lu|%lu]" ASCII_EOL,
+                  protection_armed ? "armed" : (pulse_hooked ? "passive" : "off"),
+                  probe_get_state ? "redirected" : "-",
+                  on_spindle_set_state ? "spindle" : "-",
+                  (unsigned long)hook_debug.calls,
+                  (unsigned int)hook_debug.depth_max,
+                  (unsigned long)hook_debug.ticks_last,
+                  (unsigned long)hook_debug.ticks_max,
+                  (unsigned long)hook_debug.chain_errors);
+
+    hal.stream.write(buf);
+
+    return Status_OK;
+}
+
+#endif
+
+#if PROBE_TRACE_SIZE
+
+// Dumps the trace ring oldest record first, $PROBETRACE=CLEAR empties it.
+static status_code_t dump_trace (sys_state_t state, char *args)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    uint_fast16_t idx, count, rec_idx;
+    char buf[sizeof(probe_trace_rec_t) * 2 + 12], *s;
+    uint8_t *data;
+    probe_trace_rec_t rec;
+
+    if(args) {
+        if(strcmp(args, "CLEAR"))
+            return Status_InvalidStatement;
+        hal.irq_disable();
+        trace.count = 0;
+        hal.irq_enable();
+        return Status_OK;
+    }
+
+    hal.irq_disable();
+    count = trace.count;
+    rec_idx = (trace.head + PROBE_TRACE_SIZE - trace.count) % PROBE_TRACE_SIZE;
+    hal.irq_enable();
+
+    sprintf(buf, "[PRBTRCINFO:%d,%d,%d]" ASCII_EOL, PROBE_TRACE_VERSION, (int)sizeof(probe_trace_rec_t), (int)count);
+    hal.stream.write(buf);
+
+    while(count--) {
+        s = buf + 8;
+        strcpy(buf, "[PRBTRC:");
+        hal.irq_disable();
+        rec = trace.rec[rec_idx]; // may have been overwritten by a newer record, but not half written
+        hal.irq_enable();
+        data = (uint8_t *)&rec;
+        for(idx = 0; idx < sizeof(probe_trace_rec_t); idx++) {
+            *s++ = hex[data[idx] >> 4];
+            *s++ = hex[data[idx] & 0x0F];
+        }
+        strcpy(s, "]" ASCII_EOL);
+        hal.stream.write(buf);
+        if(++rec_idx == PROBE_TRACE_SIZE)
+            rec_idx = 0;
+    }
+
+    return Status_OK;
+}
+
+#endif
+
+#if PROBE_TOOL_PARAMS_ENABLE
+
+#define PROBE_TOOL_REC_SIZE 28 // bytes, see tool_rec_pack()
+
+typedef struct {
+    uint32_t tool_id;
+    float length;   // tool length offset
+    float diameter;
+    float runout;
+    probe_tool_params_t params;
+} probe_tool_rec_t;
+
+// CRC-16/CCITT-FALSE
+static uint16_t tool_rec_crc (const uint8_t *data, uint_fast8_t len)
+{
+    uint_fast8_t bit;
+    uint16_t crc = 0xFFFF;
+
+    while(len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+static uint8_t *put_u16 (uint8_t *data, uint16_t value)
+{
+    *data++ = (uint8_t)value;
+    *data++ = (uint8_t)(value >> 8);
+
+    return data;
+}
+
+static uint8_t *put_float (uint8_t *data, float value)
+{
+    uint32_t u;
+
+    memcpy(&u, &value, sizeof(float));
+    data = put_u16(data, (uint16_t)u);
+
+    return put_u16(data, (uint16_t)(u >> 16));
+}
+
+static uint16_t get_u16 (const uint8_t *data)
+{
+    return (uint16_t)data[0] | ((uint16_t)data[1] << 8);
+}
+
+static float get_float (const uint8_t *data)
+{
+    float value;
+    uint32_t u = (uint32_t)get_u16(data) | ((uint32_t)get_u16(data + 2) << 16);
+
+    memcpy(&value, &u, sizeof(float));
+
+    return value;
+}
+
+// Little endian: tool (u16), length, diameter, runout (float), seek, feed and pulloff rates, tolerance (u16),
+// expected length (float) and CRC-16 of the preceding bytes (u16).
+static void tool_rec_pack (probe_tool_rec_t *rec, uint8_t *data)
+{
+    uint8_t *p = data;
+
+    p = put_u16(p, (uint16_t)rec->tool_id);
+    p = put_float(p, rec->length);
+    p = put_float(p, rec->diameter);
+    p = put_float(p, rec->runout);
+    p = put_u16(p, rec->params.seek_rate);
+    p = put_u16(p, rec->params.feed_rate);
+    p = put_u16(p, rec->params.pulloff_rate);
+    p = put_u16(p, rec->params.tolerance);
+    p = put_float(p, rec->params.length);
+    put_u16(p, tool_rec_crc(data, PROBE_TOOL_REC_SIZE - 2));
+}
+
+static bool tool_rec_unpack (probe_tool_rec_t *rec, const uint8_t *data)
+{
+    if(tool_rec_crc(data, PROBE_TOOL_REC_SIZE - 2) != get_u16(data + PROBE_TOOL_REC_SIZE - 2))
+        return false;
+
+    rec->tool_id = get_u16(data);
+    rec->length = get_float(data + 2);
+    rec->diameter = get_float(data + 6);
+    rec->runout = get_float(data + 10);
+    rec->params.seek_rate = get_u16(data + 14);
+    rec->params.feed_rate = get_u16(data + 16);
+    rec->params.pulloff_rate = get_u16(data + 18);
+    rec->params.tolerance = get_u16(data + 20);
+    rec->params.length = get_float(data + 22);
+
+    return true;
+}
+
+static void tool_rec_get (probe_tool_rec_t *rec, uint32_t tool_id)
+{
+    memset(rec, 0, sizeof(probe_tool_rec_t));
+
+    rec->tool_id = tool_id;
+#if N_TOOLS
+    rec->length = tool_table[tool_id].offset[Z_AXIS];
+    rec->diameter = tool_table[tool_id].radius * 2.0f;
+#elif PROBE_DIAMETER_ENABLE
+    rec->diameter = tools[tool_id].diameter;
+#endif
+#if PROBE_DIAMETER_ENABLE
+    rec->runout = tools[tool_id].runout;
+#endif
+    memcpy(&rec->params, &tool_params[tool_id], sizeof(probe_tool_params_t));
+}
+
+static void tool_rec_set (probe_tool_rec_t *rec)
+{
+#if N_TOOLS
+    tool_table[rec->tool_id].offset[Z_AXIS] = rec->length;
+    tool_table[rec->tool_id].radius = rec->diameter / 2.0f;
+    settings_write_tool_data(&tool_table[rec->tool_id]);
+#endif
+#if PROBE_DIAMETER_ENABLE
+    tools[rec->tool_id].diameter = rec->diameter;
+    tools[rec->tool_id].runout = rec->runout;
+#endif
+    memcpy(&tool_params[rec->tool_id], &rec->params, sizeof(probe_tool_params_t));
+    hal.nvs.memcpy_to_nvs(tool_params_address, (uint8_t *)tool_params, sizeof(tool_params), true);
+}
+
+static int_fast8_t hex_digit (char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+
+    return c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+// CSV import: <tool>,<length>,<diameter>,<runout>,<seek rate>,<feed rate>,<pulloff rate>,<expected length>,<tolerance>
+static status_code_t tool_import_csv (char *args, probe_tool_rec_t *rec)
+{
+    float value[9];
+    uint_fast8_t idx = 0, cc = 0;
+
+    do {
+        if(idx == 9 || !read_float(args, &cc, &value[idx++]))
+            return Status_BadNumberFormat;
+    } while(args[cc++] == ',');
+
+    if(idx != 9 || args[cc - 1] != '\0')
+        return Status_BadNumberFormat;
+
+    if(value[0] != truncf(value[0]) || value[0] < 0.0f || value[0] > (float)PROBE_TOOLS ||
+        value[4] < 0.0f || value[4] > 65535.0f || value[5] < 0.0f || value[5] > 65535.0f ||
+         value[6] < 0.0f || value[6] > 65535.0f || value[8] < 0.0f || value[8] > 65.535f)
+        return Status_GcodeValueOutOfRange;
+
+    rec->tool_id = (uint32_t)value[0];
+    rec->length = value[1];
+    rec->diameter = value[2];
+    rec->runout = value[3];
+    rec->params.seek_rate = (uint16_t)lroundf(value[4]);
+    rec->params.feed_rate = (uint16_t)lroundf(value[5]);
+    rec->params.pulloff_rate = (uint16_t)lroundf(value[6]);
+    rec->params.length = value[7];
+    rec->params.tolerance = (uint16_t)lroundf(value[8] * 1000.0f);
+
+    return Status_OK;
+}
+
+// $PROBETOOLS exports tools with data as CSV, $PROBETOOLS=HEX as binary records with checksum.
+// $PROBETOOLS=<record> imports a single tool from either format. Values are in mm and mm/min.
+static status_code_t tool_transfer (sys_state_t state, char *args)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    uint_fast16_t idx;
+    uint8_t data[PROBE_TOOL_REC_SIZE];
+    probe_tool_rec_t rec;
+    status_code_t status = Status_OK;
+
+    if(!tool_params_address)
+        return Status_SettingDisabled;
+
+    if(args == NULL || !strcmp(args, "HEX")) {
+
+        char buf[PROBE_TOOL_REC_SIZE * 2 + 16], *s;
+
+        for(idx = 0; idx <= PROBE_TOOLS; idx++) {
+
+            tool_rec_get(&rec, idx);
+
+            if(rec.length == 0.0f && rec.diameter == 0.0f && rec.runout == 0.0f &&
+                !(rec.params.seek_rate || rec.params.feed_rate || rec.params.pulloff_rate || rec.params.tolerance || rec.params.length != 0.0f))
+                continue;
+
+            if(args) {
+                uint_fast8_t i;
+
+                tool_rec_pack(&rec, data);
+                strcpy(buf, "[PRBTOOLHEX:");
+                s = strchr(buf, '\0');
+                for(i = 0; i < PROBE_TOOL_REC_SIZE; i++) {
+                    *s++ = hex[data[i] >> 4];
+                    *s++ = hex[data[i] & 0x0F];
+                }
+                strcpy(s, "]" ASCII_EOL);
+                hal.stream.write(buf);
+            } else {
+                hal.stream.write("[PRBTOOL:");
+                hal.stream.write(uitoa(rec.tool_id));
+                hal.stream.write(",");
+                hal.stream.write(ftoa(rec.length, 3));
+                hal.stream.write(",");
+                hal.stream.write(ftoa(rec.diameter, 3));
+                hal.stream.write(",");
+                hal.stream.write(ftoa(rec.runout, 4));
+                hal.stream.write(",");
+                hal.stream.write(uitoa(rec.params.seek_rate));
+                hal.stream.write(",");
+                hal.stream.write(uitoa(rec.params.feed_rate));
+                hal.stream.write(",");
+                hal.stream.write(uitoa(rec.params.pulloff_rate));
+                hal.stream.write(",");
+                hal.stream.write(ftoa(rec.params.length, 3));
+                hal.stream.write(",");
+                hal.stream.write(ftoa((float)rec.params.tolerance / 1000.0f, 3));
+                hal.stream.write("]" ASCII_EOL);
+            }
+        }
+
+        return Status_OK;
+    }
+
+    if(strchr(args, ','))
+        status = tool_import_csv(args, &rec);
+
+    else if(strlen(args) == PROBE_TOOL_REC_SIZE * 2) {
+
+        int_fast8_t hi, lo;
+
+        for(idx = 0; idx < PROBE_TOOL_REC_SIZE; idx++) {
+            if((hi = hex_digit(args[idx * 2])) < 0 || (lo = hex_digit(args[idx * 2 + 1])) < 0)
+                return Status_BadNumberFormat;
+            data[idx] = (uint8_t)((hi << 4) | lo);
+        }
+
+        if(!tool_rec_unpack(&rec, data))
+            status = Status_InvalidStatement; // checksum mismatch
+        else if(rec.tool_id > PROBE_TOOLS)
+            status = Status_GcodeValueOutOfRange;
+    } else
+        status = Status_InvalidStatement;
+
+    if(status == Status_OK)
+        tool_rec_set(&rec);
+
+    return status;
+}
+
+#endif
+
+#if PROBE_PROTECT_DEBUG || PROBE_TRACE_SIZE || PROBE_TOOL_PARAMS_ENABLE
+
+static sys_commands_t *onGetCommands (void)
+{
+    static const sys_command_t probe_command_list[] = {
+#if PROBE_TRACE_SIZE
+        {"PROBETRACE", dump_trace},
+#endif
+#if PROBE_PROTECT_DEBUG
+        {"PROBEHOOKS", report_hook_debug, { .noargs = On }},
+#endif
+#if PROBE_TOOL_PARAMS_ENABLE
+        {"PROBETOOLS", tool_transfer},
+#endif
+    };
+
+    static sys_commands_t probe_commands = {
+        .n_commands = sizeof(probe_command_list) / sizeof(sys_command_t),
+        .commands = probe_command_list
+    };
+
+    probe_commands.on_get_commands = on_get_commands;
+
+    return &probe_commands;
+}
+
+#endif
+
 static void warning_msg (uint_fast16_t state)
 {
     report_message("Probe protect plugin failed to initialize!", Message_Warning);
@@ -409,6 +3885,19 @@ static const setting_detail_t user_settings[] = {
     { PROBE_PLUGIN_PORT_SETTING1, Group_Probing, "Probe Connected Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.protect_port, NULL, NULL },
     { PROBE_PLUGIN_PORT_SETTING2, Group_Probing, "Tool Probe Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.tool_port, NULL, NULL },    
     { PROBE_PLUGIN_FIXTURE_INVERT_LIMIT_SETTING, Group_Probing, "Probe Protection Flags", NULL, Format_Bitfield, "Invert Tool Probe,Hard Limits, External Connected Pin, Invert External Connected Pin, Alternate Tool Probe Pin, Invert Tool Probe Pin", NULL, NULL, Setting_NonCore, &probe_protect_settings.flags, NULL, NULL },
+    { PROBE_PLUGIN_TIP_RADIUS_SETTING, Group_Probing, "Probe Tip Radius", "mm", Format_Decimal, "#0.000", "0", "10", Setting_NonCore, &probe_protect_settings.tip_radius, NULL, NULL },
+#if PROBE_POINT_CACHE_SIZE || PROBE_TOOL_CHECK_ENABLE || PROBE_GRID_ENABLE || PROBE_HEIGHTMAP_ENABLE
+    { PROBE_PLUGIN_STANDOFF_SETTING, Group_Probing, "Probe Approach Standoff", "mm", Format_Decimal, "#0.000", "0", "100", Setting_NonCore, &probe_protect_settings.approach_standoff, NULL, NULL },
+#endif
+    { PROBE_PLUGIN_OVERTRAVEL_SETTING, Group_Probing, "Probe Stylus Overtravel", "mm", Format_Decimal, "#0.000", "0", "20", Setting_NonCore, &probe_protect_settings.overtravel, NULL, NULL },
+    { PROBE_PLUGIN_LATENCY_SETTING, Group_Probing, "Probe Trigger Latency", "ms", Format_Decimal, "#0.0", "0", "100", Setting_NonCore, &probe_protect_settings.latency, NULL, NULL },
+#if PROBE_TUNE_ENABLE
+    { PROBE_PLUGIN_TUNE_TOLERANCE_SETTING, Group_Probing, "Probe Tune Tolerance", "mm", Format_Decimal, "#0.0000", "0", "1", Setting_NonCore, &probe_protect_settings.tune_tolerance, NULL, NULL },
+#endif
+#if PROBE_DIAMETER_ENABLE
+    { PROBE_PLUGIN_SETTER_DIAMETER_SETTING, Group_Probing, "Toolsetter Diameter", "mm", Format_Decimal, "#0.000", "0", "100", Setting_NonCore, &probe_protect_settings.setter_diameter, NULL, NULL },
+#endif
+    { PROBE_PLUGIN_OPTIONS_SETTING, Group_Probing, "Probe Plugin Options", NULL, Format_Bitfield, "Connect Macro,Disconnect Macro,Keep M401 Over Power Cycle,Quick Check Measured Tools", NULL, NULL, Setting_NonCore, &probe_protect_settings.options, NULL, NULL },
 };
 
 #ifndef NO_SETTINGS_DESCRIPTIONS
@@ -427,7 +3916,37 @@ static const setting_descr_t probe_protect_settings_descr[] = {
                             "Enable alternate pin input for Tool Probe signal.\\n"
                             "Invert alternate pin input for Tool Probe signal.\\n\\n"                            
                             "NOTE: A hard reset of the controller is required after changing this setting."
-    },   
+    },
+    { PROBE_PLUGIN_TIP_RADIUS_SETTING, "Stylus tip radius used for compensating X and Y contact positions when M403 updates a work offset."
+    },
+#if PROBE_POINT_CACHE_SIZE || PROBE_TOOL_CHECK_ENABLE || PROBE_GRID_ENABLE || PROBE_HEIGHTMAP_ENABLE
+    { PROBE_PLUGIN_STANDOFF_SETTING, "Distance before the expected contact position to move to before probing: the remembered contact of a M405 tagged probe point, "
+                            "the last contact of a tool measured again by the quick check (5 mm if 0) and the previous point of M411 and M412.\\n"
+                            "M405 points, M411 and M412 approach at the feed rate limited by the Probe Stylus Overtravel setting, the quick check at the tool change seek rate. Only used while probe protection is armed.\\n"
+                            "Set to 0 to disable."
+    },
+#endif
+    { PROBE_PLUGIN_OVERTRAVEL_SETTING, "Allowable stylus overtravel after the trigger point.\\n"
+                            "G38 feed rates are limited so the machine stops within this distance, based on axis acceleration and trigger latency. Toolsetter probing is not limited.\\n"
+                            "Set to 0 to disable."
+    },
+    { PROBE_PLUGIN_LATENCY_SETTING, "Time from stylus contact to start of deceleration, including probe trigger and controller response."
+    },
+#if PROBE_TUNE_ENABLE
+    { PROBE_PLUGIN_TUNE_TOLERANCE_SETTING, "Max spread of repeated trigger positions accepted by the M406 feed rate tuner."
+    },
+#endif
+#if PROBE_DIAMETER_ENABLE
+    { PROBE_PLUGIN_SETTER_DIAMETER_SETTING, "Diameter of the toolsetter contact surface, used by M407 for radial tool measurement.\\n"
+                            "Set to 0 to disable."
+    },
+#endif
+    { PROBE_PLUGIN_OPTIONS_SETTING, "Run " PROBE_CONNECT_MACRO " when the probe is connected.\\n"
+                            "Run " PROBE_DISCONNECT_MACRO " when the probe is disconnected.\\n"
+                            "Restore probe connected state set by M401 after a power cycle.\\n"
+                            "Only check the length of tools already measured since reset, see M408.\\n\\n"
+                            "NOTE: Macros are cached in RAM on first use, changing this setting reloads them."
+    },
 };
 
 #endif
@@ -435,18 +3954,53 @@ static const setting_descr_t probe_protect_settings_descr[] = {
 // Write settings to non volatile storage (NVS).
 static void plugin_settings_save (void)
 {
-    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&probe_protect_settings, sizeof(probe_protect_settings_t), true);
+    overtravel_limit_reported = false;
+#if PROBE_MACROS_ENABLE
+    macro_clear_cache();
+#endif
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&probe_protect_settings, PROBE_SETTINGS_BASE_SIZE, true);
+    if(nvs_ext_address)
+        hal.nvs.memcpy_to_nvs(nvs_ext_address, (uint8_t *)&probe_protect_settings.version, PROBE_SETTINGS_EXT_SIZE, true);
 }
 
-// Restore default settings and write to non volatile storage (NVS).
 // Default is highest numbered free port.
-static void plugin_settings_restore (void)
+static void settings_restore_base (void)
 {
     probe_protect_settings.protect_port = hal.port.num_digital_out ? hal.port.num_digital_out - 1 : 0;
     probe_protect_settings.tool_port = hal.port.num_digital_out ? hal.port.num_digital_out - 1 : 0;
     probe_protect_settings.flags.value = 0;
 
-    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&probe_protect_settings, sizeof(probe_protect_settings_t), true);
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&probe_protect_settings, PROBE_SETTINGS_BASE_SIZE, true);
+}
+
+static void settings_restore_ext (void)
+{
+    probe_protect_settings.version = PROBE_SETTINGS_VERSION;
+    probe_protect_settings.options.value = 0;
+    probe_protect_settings.mcode_connected = false;
+    probe_protect_settings.tip_radius = 0.0f;
+    probe_protect_settings.approach_standoff = 0.0f;
+    probe_protect_settings.overtravel = 0.0f;
+    probe_protect_settings.latency = 0.0f;
+    probe_protect_settings.tune_tolerance = 0.005f;
+    probe_protect_settings.setter_diameter = 0.0f;
+
+    if(nvs_ext_address)
+        hal.nvs.memcpy_to_nvs(nvs_ext_address, (uint8_t *)&probe_protect_settings.version, PROBE_SETTINGS_EXT_SIZE, true);
+}
+
+// Restore default settings and write to non volatile storage (NVS).
+static void plugin_settings_restore (void)
+{
+    settings_restore_base();
+    settings_restore_ext();
+
+#if PROBE_TOOL_PARAMS_ENABLE
+    if(tool_params_address) {
+        memset(tool_params, 0, sizeof(tool_params));
+        hal.nvs.memcpy_to_nvs(tool_params_address, (uint8_t *)tool_params, sizeof(tool_params), true);
+    }
+#endif
 }
 
 static void warning_no_port (uint_fast16_t state)
@@ -458,8 +4012,22 @@ static void warning_no_port (uint_fast16_t state)
 // If load fails restore to default values.
 static void plugin_settings_load (void)
 {
-    if(hal.nvs.memcpy_from_nvs((uint8_t *)&probe_protect_settings, nvs_address, sizeof(probe_protect_settings_t), true) != NVS_TransferResult_OK)
-        plugin_settings_restore();
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&probe_protect_settings, nvs_address, PROBE_SETTINGS_BASE_SIZE, true) != NVS_TransferResult_OK)
+        settings_restore_base();
+
+    // Extended settings are reset to defaults if missing, e.g. after upgrading from a version without them,
+    // or if saved with another layout. Convert older layouts here when PROBE_SETTINGS_VERSION is incremented.
+    if(!nvs_ext_address ||
+        hal.nvs.memcpy_from_nvs((uint8_t *)&probe_protect_settings.version, nvs_ext_address, PROBE_SETTINGS_EXT_SIZE, true) != NVS_TransferResult_OK ||
+         probe_protect_settings.version != PROBE_SETTINGS_VERSION)
+        settings_restore_ext();
+
+#if PROBE_TOOL_PARAMS_ENABLE
+    if(tool_params_address && hal.nvs.memcpy_from_nvs((uint8_t *)tool_params, tool_params_address, sizeof(tool_params), true) != NVS_TransferResult_OK) {
+        memset(tool_params, 0, sizeof(tool_params));
+        hal.nvs.memcpy_to_nvs(tool_params_address, (uint8_t *)tool_params, sizeof(tool_params), true);
+    }
+#endif
 
     // Sanity check
     if(probe_protect_settings.protect_port >= n_ports)
@@ -471,6 +4039,9 @@ static void plugin_settings_load (void)
     probe_connect_port = probe_protect_settings.protect_port;
     nvs_invert_probe_pin = settings.probe.invert_probe_pin;
 
+    if(probe_protect_settings.options.keep_mcode && probe_protect_settings.mcode_connected)
+        connected_set(PROBE_CONNECTED_MCODE, true);
+
     if(probe_protect_settings.flags.ext_pin){
         if(ioport_claim(Port_Digital, Port_Input, &probe_connect_port, "Probe Connected")) {
 
@@ -480,7 +4051,7 @@ static void plugin_settings_load (void)
             protocol_enqueue_rt_command(warning_no_port);    
 
         //Try to register the interrupt handler.
-        if(!(hal.port.register_interrupt_handler(probe_connect_port, IRQ_Mode_Change, set_connected)))
+        if(!(ext_pin_ok = hal.port.register_interrupt_handler(probe_connect_port, IRQ_Mode_Change, set_connected)))
             protocol_enqueue_rt_command(warning_no_port);
     }
 
@@ -514,7 +4085,7 @@ static setting_details_t setting_details = {
 void probe_protect_init (void)
 {
     bool ok = (n_ports = ioports_available(Port_Digital, Port_Input));
-    probe_connected.value = 0;
+    probe_connected = 0;
 
     //Register function pointers
     probe_connected_toggle = hal.probe.connected_toggle;
@@ -535,9 +4106,22 @@ void probe_protect_init (void)
     on_tool_selected = grbl.on_tool_selected;
     grbl.on_tool_selected = onToolSelected;
 
+#if PROBE_TOOL_PARAMS_ENABLE
+    on_tool_changed = grbl.on_tool_changed;
+    grbl.on_tool_changed = onToolChanged;
+#endif
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = onExecuteRealtime;
+
     driver_reset = hal.driver_reset;
     hal.driver_reset = probe_reset;
 
+#if PROBE_PROTECT_DEBUG || PROBE_TRACE_SIZE || PROBE_TOOL_PARAMS_ENABLE
+    on_get_commands = grbl.on_get_commands;
+    grbl.on_get_commands = onGetCommands;
+#endif
+
     //note that these do not chain.
     hal.user_mcode.check = mcode_check;
     hal.user_mcode.validate = mcode_validate;
@@ -562,25 +4146,25 @@ void probe_protect_init (void)
             grbl.on_report_options = report_options;
         }
 
-    } else if((ok = (nvs_address = nvs_alloc(sizeof(probe_protect_settings_t))))) {
+    } else if((ok = (nvs_address = nvs_alloc(PROBE_SETTINGS_BASE_SIZE)))) {
+
+        nvs_ext_address = nvs_alloc(PROBE_SETTINGS_EXT_SIZE);
 
         on_report_options = grbl.on_report_options;
         grbl.on_report_options = report_options;
 
+#if PROBE_TOOL_PARAMS_ENABLE
+        tool_params_address = nvs_alloc(sizeof(tool_params));
+#endif
+
         settings_register(&setting_details);
 
         // Used for setting value validation
         strcpy(max_port, uitoa(n_ports - 1));
     }
 
-    //need to add some init code to check the pin states (if enabled) and set the connected flag on or off.
-    /*
-    probe_state_t probe = hal.probe.get_state();
-
-    if(probe.connected) {
-        if(probe_connected_toggle)
-            probe_connected_toggle();        
-    }*/
+    // set the initial connected state once settings are loaded and the connected pin is claimed.
+    protocol_enqueue_rt_command(connected_reconcile);
 
     if(!ok)
         protocol_enqueue_rt_command(warning_msg);
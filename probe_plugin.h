@@ -30,12 +30,45 @@
 #include "../../grbl/state_machine.h"
 #include "../../grbl/report.h"
 #include "../../grbl/nvs_buffer.h"
+#include "../../grbl/motion_control.h"
 #else
 #include "grbl/hal.h"
 #include "grbl/protocol.h"
 #include "grbl/state_machine.h"
 #include "grbl/report.h"
 #include "grbl/nvs_buffer.h"
+#include "grbl/motion_control.h"
 #endif
 
-/**/
+#ifndef _PROBE_PLUGIN_H_
+#define _PROBE_PLUGIN_H_
+
+#ifndef PROBE_SUBSCRIBERS_MAX
+#define PROBE_SUBSCRIBERS_MAX 4
+#endif
+
+typedef enum {
+    ProbeEvent_Completed = 0,   // probe cycle completed, succeeded or not
+    ProbeEvent_Connected,       // probe connected, protection armed
+    ProbeEvent_Disconnected,    // probe disconnected, protection off
+    ProbeEvent_Tripped          // probe protection tripped, a reset has been requested
+} probe_event_t;
+
+typedef struct {
+    probe_event_t event;
+    uint8_t probe_id;           // 0: probe, 1: toolsetter
+    bool succeeded;             // ProbeEvent_Completed only
+    uint8_t connected;          // probe connected state: bit 0 - toggle, bit 1 - M401, bit 2 - external pin, bit 3 - T99
+    uint32_t ms;                // timestamp
+    float position[N_AXIS];     // machine position, trigger position for ProbeEvent_Completed
+} probe_result_t;
+
+typedef void (*probe_event_handler_ptr)(const probe_result_t *result);
+
+// Register a handler for probe results and connect, disconnect and protection trip events.
+// Handlers are called from the foreground process, except for connect and disconnect
+// events that are delivered from the probe connected toggle handler.
+// Returns false if all PROBE_SUBSCRIBERS_MAX slots are taken.
+bool probe_plugin_subscribe (probe_event_handler_ptr handler);
+
+#endif
@@ -0,0 +1,76 @@
+/*
+
+  probe_trace.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Binary probe trace record format, shared by the plugin and the host side decoder in tools/.
+  Do not include any grblHAL headers here.
+
+  Records are dumped with $PROBETRACE as one line per record:
+
+    [PRBTRC:<record as hex, little endian>]
+
+  preceded by a [PRBTRCINFO:<version>,<record size>,<number of records>] line.
+
+*/
+
+#ifndef _PROBE_TRACE_H_
+#define _PROBE_TRACE_H_
+
+#include <stdint.h>
+
+#define PROBE_TRACE_VERSION 2
+#define PROBE_TRACE_AXES    3 // X, Y and Z
+
+typedef enum {
+    ProbeTrace_Start = 0,   // pos: start position, feed: programmed feed rate
+    ProbeTrace_Target,      // pos: target position
+    ProbeTrace_Trigger,     // pos: trigger position, flags: ProbeTraceFlag_Succeeded
+    ProbeTrace_Connected,   // flags: probe connected state (toggle, mcode, ext_pin, t99 bits)
+    ProbeTrace_ToolSelected,// tool_id: tool number
+    ProbeTrace_MCode,       // flags: M-code - 400
+    ProbeTrace_Tripped,     // probe protection tripped, pos: machine position
+    ProbeTrace_Reset        // controller reset
+} probe_trace_type_t;
+
+typedef enum {
+    ProbeTraceFlag_Succeeded   = 1 << 0,
+    ProbeTraceFlag_InverseTime = 1 << 1
+} probe_trace_flags_t;
+
+typedef enum {
+    ProbeTraceId_Probe = 0,
+    ProbeTraceId_Toolsetter
+} probe_trace_id_t;
+
+// 24 bytes, naturally aligned without padding.
+typedef struct {
+    uint8_t type;       // probe_trace_type_t
+    uint8_t probe_id;   // probe_trace_id_t
+    uint8_t flags;      // probe_trace_flags_t or probe connected state
+    uint8_t cycle;      // probe cycle number, wraps
+    uint32_t ms;        // controller timestamp
+    float feed_rate;    // mm/min
+    union {
+        int32_t position[PROBE_TRACE_AXES]; // machine position in micrometers
+        uint32_t tool_id;                   // ProbeTrace_ToolSelected, remaining bytes are 0
+    };
+} probe_trace_rec_t;
+
+#endif
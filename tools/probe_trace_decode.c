@@ -0,0 +1,201 @@
+/*
+
+  probe_trace_decode.c - host side decoder for $PROBETRACE dumps
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Reads a console log containing one or more $PROBETRACE dumps from stdin and writes CSV to stdout,
+  other lines in the log are ignored.
+
+  Build: cc -O2 -o probe_trace_decode tools/probe_trace_decode.c -I.
+
+  Usage: probe_trace_decode [-r] < log.txt > cycles.csv
+
+    -r  write one row per record instead of one row per probe cycle.
+
+  Traces are replayed through the plugin with tools/sim/probe_trace_replay.
+
+  Not part of the firmware build, excluded if PROBE_PROTECT_ENABLE is defined.
+
+*/
+
+#ifndef PROBE_PROTECT_ENABLE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "probe_trace.h"
+
+typedef struct {
+    bool started;
+    probe_trace_rec_t start;
+    probe_trace_rec_t target;
+} cycle_t;
+
+typedef enum {
+    Output_Cycles = 0,
+    Output_Records
+} output_t;
+
+static const char *type_names[] = { "start", "target", "trigger", "connected", "tool", "mcode", "tripped", "reset" };
+
+static int hex_value (char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+static uint32_t get_u32 (const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Decodes explicitly from little endian so the tool does not depend on host byte order or struct layout.
+static bool decode_record (const char *hex, probe_trace_rec_t *rec)
+{
+    uint8_t data[sizeof(probe_trace_rec_t)];
+    uint32_t u;
+    int idx, hi, lo;
+
+    for(idx = 0; idx < (int)sizeof(data); idx++) {
+        if((hi = hex_value(hex[idx * 2])) < 0 || (lo = hex_value(hex[idx * 2 + 1])) < 0)
+            return false;
+        data[idx] = (uint8_t)((hi << 4) | lo);
+    }
+
+    if(hex[sizeof(data) * 2] != ']')
+        return false;
+
+    rec->type = data[0];
+    rec->probe_id = data[1];
+    rec->flags = data[2];
+    rec->cycle = data[3];
+    rec->ms = get_u32(&data[4]);
+    u = get_u32(&data[8]);
+    memcpy(&rec->feed_rate, &u, sizeof(float));
+    for(idx = 0; idx < PROBE_TRACE_AXES; idx++)
+        rec->position[idx] = (int32_t)get_u32(&data[12 + idx * 4]);
+
+    return true;
+}
+
+static void print_position (const probe_trace_rec_t *rec)
+{
+    int idx;
+
+    for(idx = 0; idx < PROBE_TRACE_AXES; idx++)
+        printf(",%.3f", (double)rec->position[idx] / 1000.0);
+}
+
+static void print_record (const probe_trace_rec_t *rec)
+{
+    printf("%u,%lu,%s,%u,0x%02X,%.1f", rec->cycle, (unsigned long)rec->ms,
+            rec->type < sizeof(type_names) / sizeof(char *) ? type_names[rec->type] : "unknown",
+             rec->probe_id, rec->flags, (double)rec->feed_rate);
+    print_position(rec);
+    printf("\n");
+}
+
+static void print_cycle (const cycle_t *cycle, const probe_trace_rec_t *trigger)
+{
+    printf("%u,%u,%lu,%lu,%.1f,%d", trigger->cycle, trigger->probe_id, (unsigned long)cycle->start.ms,
+            (unsigned long)(trigger->ms - cycle->start.ms), (double)cycle->start.feed_rate,
+             (trigger->flags & ProbeTraceFlag_Succeeded) ? 1 : 0);
+    print_position(&cycle->start);
+    print_position(&cycle->target);
+    print_position(trigger);
+    printf("\n");
+}
+
+int main (int argc, char **argv)
+{
+    char line[256], *s;
+    output_t output = argc > 1 && !strcmp(argv[1], "-r") ? Output_Records : Output_Cycles;
+    unsigned long records = 0, errors = 0;
+    probe_trace_rec_t rec;
+    cycle_t cycle = {0};
+
+    if(output == Output_Records)
+        printf("cycle,ms,type,probe_id,flags,feed,x,y,z\n");
+    else
+        printf("cycle,probe_id,start_ms,duration_ms,feed,succeeded,start_x,start_y,start_z,target_x,target_y,target_z,trigger_x,trigger_y,trigger_z\n");
+
+    while(fgets(line, sizeof(line), stdin)) {
+
+        if(!strncmp(line, "[PRBTRCINFO:", 12)) {
+            int version = 0, size = 0;
+            if(sscanf(line + 12, "%d,%d", &version, &size) != 2 || version != PROBE_TRACE_VERSION || size != (int)sizeof(probe_trace_rec_t)) {
+                fprintf(stderr, "unsupported trace version %d or record size %d\n", version, size);
+                return 1;
+            }
+            cycle.started = false;
+            continue;
+        }
+
+        if((s = strstr(line, "[PRBTRC:")) == NULL)
+            continue;
+
+        if(!decode_record(s + 8, &rec)) {
+            errors++;
+            continue;
+        }
+
+        records++;
+
+        if(output == Output_Records) {
+            print_record(&rec);
+            continue;
+        }
+
+        switch(rec.type) {
+
+            case ProbeTrace_Start:
+                cycle.started = true;
+                cycle.start = rec;
+                memset(&cycle.target, 0, sizeof(probe_trace_rec_t));
+                break;
+
+            case ProbeTrace_Target:
+                cycle.target = rec;
+                break;
+
+            case ProbeTrace_Trigger:
+                if(cycle.started && cycle.start.cycle == rec.cycle)
+                    print_cycle(&cycle, &rec);
+                cycle.started = false;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    fprintf(stderr, "%lu records decoded, %lu malformed\n", records, errors);
+
+    return errors ? 2 : 0;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+
+  driver.h - host simulator stand-in for the driver configuration, see grbl/hal.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SIM_DRIVER_H_
+#define _SIM_DRIVER_H_
+
+#include "grbl/hal.h"
+
+#ifndef PROBE_PROTECT_ENABLE
+#define PROBE_PROTECT_ENABLE 1
+#endif
+
+#ifndef SDCARD_ENABLE
+#define SDCARD_ENABLE 1 // files are read from and written to the simulator working directory
+#endif
+
+#endif
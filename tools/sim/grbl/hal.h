@@ -0,0 +1,453 @@
+/*
+
+  hal.h - host simulator stand-in for the grblHAL core interface used by the probe plugin
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Only the types, members and functions referenced by probe_plugin.c are declared, with the same
+  names and meaning as in the core. The implementation is in probe_sim.c.
+
+*/
+
+#ifndef _SIM_HAL_H_
+#define _SIM_HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define N_AXIS 3
+#define X_AXIS 0
+#define Y_AXIS 1
+#define Z_AXIS 2
+
+#define N_TOOLS 16
+#define NGC_EXPRESSIONS_ENABLE 1
+#define TOOLSETTER_RADIUS 5.0f
+
+#define ISR_CODE
+#define ASCII_EOL "\r\n"
+#define ASCII_LF '\n'
+#define SERIAL_NO_DATA -1
+
+#define On 1
+#define Off 0
+#define bit(n) (1UL << (n))
+#define bit_istrue(x, mask) ((x & (mask)) != 0)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define CMD_RESET 0x18
+#define CMD_FEED_HOLD 0x21
+#define CMD_PROBE_CONNECTED_TOGGLE 0x9E
+
+#define STATE_IDLE 0
+#define STATE_ALARM bit(0)
+#define STATE_CHECK_MODE bit(1)
+#define STATE_CYCLE bit(3)
+#define STATE_HOLD bit(4)
+#define STATE_TOOL_CHANGE bit(8)
+
+typedef uint_fast16_t sys_state_t;
+typedef uint32_t nvs_address_t;
+
+typedef enum {
+    Status_OK = 0,
+    Status_BadNumberFormat = 2,
+    Status_InvalidStatement = 3,
+    Status_SettingDisabled = 7,
+    Status_IdleError = 8,
+    Status_SystemGClock = 9,
+    Status_GcodeUnsupportedCommand = 20,
+    Status_GcodeValueWordMissing = 28,
+    Status_GcodeValueOutOfRange = 33,
+    Status_FileOpenFailed = 62,
+    Status_FsFailedOpenFile = 62,
+    Status_FsFailedRead = 63,
+    Status_ExpressionInvalidArgument = 68,
+    Status_FlowControlStackOverflow = 70,
+    Status_Unhandled = 255
+} status_code_t;
+
+typedef enum {
+    Message_Plain = 0,
+    Message_Info,
+    Message_Warning
+} message_type_t;
+
+typedef enum {
+    NVS_TransferResult_OK = 0,
+    NVS_TransferResult_Failed
+} nvs_transfer_result_t;
+
+typedef enum { Port_Digital, Port_Analog } io_port_type_t;
+typedef enum { Port_Input, Port_Output } io_port_direction_t;
+typedef enum { WaitMode_Immediate } wait_mode_t;
+typedef enum { IRQ_Mode_Change } pin_irq_mode_t;
+typedef enum { UserMCode_Ignore = 0 } user_mcode_t;
+
+typedef enum {
+    Setting_UserDefined_0 = 450,
+    Setting_UserDefined_1,
+    Setting_UserDefined_2,
+    Setting_UserDefined_3,
+    Setting_UserDefined_4,
+    Setting_UserDefined_5,
+    Setting_UserDefined_6,
+    Setting_UserDefined_7,
+    Setting_UserDefined_8,
+    Setting_UserDefined_9
+} setting_id_t;
+
+typedef enum { Group_Root, Group_Probing } setting_group_t;
+typedef enum { Format_Bool, Format_Bitfield, Format_XBitfield, Format_RadioButtons, Format_AxisMask, Format_Integer, Format_Decimal, Format_String, Format_Int8, Format_Int16 } setting_datatype_t;
+typedef enum { Setting_NonCore, Setting_IsExtended } setting_type_t;
+
+typedef enum {
+    CoordinateSystem_G54 = 0,
+    CoordinateSystem_G55,
+    CoordinateSystem_G56,
+    CoordinateSystem_G57,
+    CoordinateSystem_G58,
+    CoordinateSystem_G59,
+    CoordinateSystem_G28,
+    CoordinateSystem_G30,
+    CoordinateSystem_G59_3,
+    N_CoordinateSystems
+} coord_system_id_t;
+
+typedef enum {
+    MotionMode_Seek = 0,
+    MotionMode_Linear = 1,
+    MotionMode_ProbeToward = 140,
+    MotionMode_ProbeTowardNoError = 141,
+    MotionMode_ProbeAway = 142,
+    MotionMode_ProbeAwayNoError = 143,
+    MotionMode_None = 80
+} motion_mode_t;
+
+typedef union {
+    uint8_t value;
+    uint8_t mask;
+    struct {
+        uint8_t x :1,
+                y :1,
+                z :1,
+                unused :5;
+    };
+} axes_signals_t;
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t on  :1,
+                ccw :1,
+                unused :6;
+    };
+} spindle_state_t;
+
+typedef struct {
+    uint8_t triggered :1,
+            connected :1,
+            unused    :6;
+} probe_state_t;
+
+typedef union {
+    uint32_t value;
+    struct {
+        uint32_t rapid_motion     :1,
+                 system_motion    :1,
+                 inverse_time     :1,
+                 no_feed_override :1,
+                 unused           :28;
+    };
+} planner_cond_t;
+
+typedef struct {
+    float feed_rate;
+    float spindle_rpm;
+    planner_cond_t condition;
+} plan_line_data_t;
+
+typedef struct {
+    float offset[N_AXIS];
+    float radius;
+    uint32_t tool_id;
+} tool_data_t;
+
+typedef struct stepper stepper_t;
+typedef struct { float unused; } parameter_words_t;
+
+typedef union {
+    uint32_t mask;
+    struct {
+        uint32_t $ :1, a :1, b :1, c :1, d :1, e :1, f :1, h :1, i :1, j :1, k :1, l :1, n :1,
+                 o :1, p :1, q :1, r :1, s :1, t :1, u :1, v :1, w :1, x :1, y :1, z :1;
+    };
+} parameter_words_map_t;
+
+typedef parameter_words_map_t words_t;
+
+typedef struct {
+    float d, e, f, h, p, q, r, s, t;
+    float ijk[3];
+    float xyz[N_AXIS];
+    uint8_t l;
+} gc_values_t;
+
+typedef struct {
+    user_mcode_t user_mcode;
+    words_t words;
+    gc_values_t values;
+} parser_block_t;
+
+typedef void (*spindle_set_state_ptr)(spindle_state_t state, float rpm);
+
+typedef struct {
+    spindle_set_state_ptr set_state;
+} spindle_ptrs_t;
+
+typedef void (*stepper_pulse_start_ptr)(stepper_t *stepper);
+typedef probe_state_t (*probe_get_state_ptr)(void);
+typedef void (*probe_connected_toggle_ptr)(void);
+typedef void (*driver_reset_ptr)(void);
+typedef int16_t (*stream_read_ptr)(void);
+typedef void (*ioport_interrupt_callback_ptr)(uint8_t port, bool state);
+
+typedef bool (*on_probe_start_ptr)(axes_signals_t axes, float *target, plan_line_data_t *pl_data);
+typedef void (*on_probe_completed_ptr)(void);
+typedef bool (*on_probe_fixture_ptr)(tool_data_t *tool, bool at_g59_3, bool on);
+typedef bool (*on_spindle_select_ptr)(spindle_ptrs_t *spindle);
+typedef void (*on_tool_selected_ptr)(tool_data_t *tool);
+typedef void (*on_tool_changed_ptr)(tool_data_t *tool);
+typedef void (*on_report_options_ptr)(bool newopt);
+typedef void (*on_execute_realtime_ptr)(sys_state_t state);
+typedef status_code_t (*status_message_ptr)(status_code_t status_code);
+
+typedef status_code_t (*sys_command_ptr)(sys_state_t state, char *args);
+
+typedef struct {
+    uint8_t noargs        :1,
+            allow_blocking :1,
+            unused        :6;
+} sys_command_flags_t;
+
+typedef struct {
+    const char *command;
+    sys_command_ptr execute;
+    sys_command_flags_t flags;
+} sys_command_t;
+
+typedef struct sys_commands_str {
+    const uint8_t n_commands;
+    const sys_command_t *commands;
+    struct sys_commands_str *(*on_get_commands)(void);
+} sys_commands_t;
+
+typedef sys_commands_t *(*on_get_commands_ptr)(void);
+
+typedef struct {
+    user_mcode_t (*check)(user_mcode_t mcode);
+    status_code_t (*validate)(parser_block_t *gc_block, parameter_words_t *deprecated);
+    void (*execute)(uint_fast16_t state, parser_block_t *gc_block);
+} user_mcode_ptrs_t;
+
+typedef struct {
+    uint32_t (*get_elapsed_ticks)(void);
+    uint32_t (*get_micros)(void);
+    void (*delay_ms)(uint32_t ms, void (*callback)(void));
+    void (*irq_enable)(void);
+    void (*irq_disable)(void);
+    uint_fast16_t (*set_bits_atomic)(volatile uint_fast16_t *ptr, uint_fast16_t bits);
+    uint_fast16_t (*clear_bits_atomic)(volatile uint_fast16_t *ptr, uint_fast16_t bits);
+    driver_reset_ptr driver_reset;
+    struct {
+        stepper_pulse_start_ptr pulse_start;
+    } stepper;
+    struct {
+        probe_get_state_ptr get_state;
+        probe_connected_toggle_ptr connected_toggle;
+    } probe;
+    struct {
+        void (*enable)(bool on, axes_signals_t homing);
+    } limits;
+    struct {
+        uint8_t num_digital_in;
+        uint8_t num_digital_out;
+        int32_t (*wait_on_input)(io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout);
+        bool (*register_interrupt_handler)(uint8_t port, pin_irq_mode_t irq_mode, ioport_interrupt_callback_ptr interrupt_callback);
+        void (*set_pin_description)(io_port_type_t type, io_port_direction_t dir, uint8_t port, const char *description);
+    } port;
+    struct {
+        stream_read_ptr read;
+        void (*write)(const char *s);
+    } stream;
+    struct {
+        nvs_transfer_result_t (*memcpy_from_nvs)(uint8_t *dest, nvs_address_t source, uint32_t size, bool with_checksum);
+        nvs_transfer_result_t (*memcpy_to_nvs)(nvs_address_t dest, uint8_t *source, uint32_t size, bool with_checksum);
+    } nvs;
+    user_mcode_ptrs_t user_mcode;
+} grbl_hal_t;
+
+extern grbl_hal_t hal;
+
+typedef struct {
+    bool (*enqueue_realtime_command)(char c);
+    on_probe_start_ptr on_probe_start;
+    on_probe_completed_ptr on_probe_completed;
+    on_probe_fixture_ptr on_probe_fixture;
+    on_spindle_select_ptr on_spindle_select;
+    on_tool_selected_ptr on_tool_selected;
+    on_tool_changed_ptr on_tool_changed;
+    on_report_options_ptr on_report_options;
+    on_get_commands_ptr on_get_commands;
+    on_execute_realtime_ptr on_execute_realtime;
+    struct {
+        status_message_ptr status_message;
+    } report;
+} grbl_t;
+
+extern grbl_t grbl;
+
+typedef struct {
+    float steps_per_mm;
+    float max_rate;
+    float acceleration; // mm/min^2
+} axis_settings_t;
+
+typedef struct {
+    struct {
+        bool invert_probe_pin;
+    } probe;
+    struct {
+        struct {
+            uint8_t hard_enabled :1,
+                    unused       :7;
+        } flags;
+    } limits;
+    struct {
+        float feed_rate;
+        float seek_rate;
+        float pulloff_rate;
+    } tool_change;
+    axis_settings_t axis[N_AXIS];
+} settings_t;
+
+extern settings_t settings;
+
+typedef struct {
+    uint8_t probe_succeeded :1,
+            unused          :7;
+} system_flags_t;
+
+typedef struct {
+    volatile bool abort;
+    system_flags_t flags;
+    int32_t position[N_AXIS];
+    int32_t probe_position[N_AXIS];
+} system_t;
+
+extern system_t sys;
+
+typedef struct {
+    coord_system_id_t id;
+    float xyz[N_AXIS];
+} coord_system_t;
+
+typedef struct {
+    motion_mode_t motion;
+    uint8_t units_imperial;
+    uint8_t distance_incremental;
+    coord_system_t coord_system;
+} gc_modal_t;
+
+typedef struct {
+    gc_modal_t modal;
+    float feed_rate;
+    float position[N_AXIS];
+    float g92_coord_offset[N_AXIS];
+    float tool_length_offset[N_AXIS];
+    tool_data_t *tool;
+} parser_state_t;
+
+extern parser_state_t gc_state;
+extern tool_data_t tool_table[N_TOOLS + 1];
+
+typedef struct {
+    setting_group_t parent;
+    setting_group_t id;
+    const char *name;
+} setting_group_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    setting_group_t group;
+    const char *name;
+    const char *unit;
+    setting_datatype_t datatype;
+    const char *format;
+    const char *min_value;
+    const char *max_value;
+    setting_type_t type;
+    void *value;
+    void *get_value;
+    void *is_available;
+} setting_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    const char *description;
+} setting_descr_t;
+
+typedef struct setting_details {
+    const setting_group_detail_t *groups;
+    uint8_t n_groups;
+    const setting_detail_t *settings;
+    uint8_t n_settings;
+    const setting_descr_t *descriptions;
+    uint8_t n_descriptions;
+    void (*save)(void);
+    void (*load)(void);
+    void (*restore)(void);
+} setting_details_t;
+
+void settings_register (setting_details_t *details);
+bool settings_read_coord_data (coord_system_id_t id, float (*coord_data)[N_AXIS]);
+void settings_write_coord_data (coord_system_id_t id, float (*coord_data)[N_AXIS]);
+void settings_write_global (void);
+bool settings_write_tool_data (tool_data_t *tool_data);
+
+uint8_t ioports_available (io_port_type_t type, io_port_direction_t dir);
+bool ioport_claim (io_port_type_t type, io_port_direction_t dir, uint8_t *port, const char *description);
+bool ioport_can_claim_explicit (void);
+
+char *uitoa (uint32_t n);
+char *ftoa (float n, uint8_t decimal_places);
+bool read_float (char *line, uint_fast8_t *char_counter, float *float_ptr);
+float convert_delta_vector_to_unit_vector (float *vector);
+
+bool system_convert_array_steps_to_mpos (float *position, int32_t *steps);
+float system_convert_axis_steps_to_mpos (int32_t *steps, uint_fast8_t idx);
+void system_flag_wco_change (void);
+
+#include "planner.h"
+
+#endif
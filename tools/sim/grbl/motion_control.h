@@ -0,0 +1,31 @@
+/*
+
+  motion_control.h - host simulator stand-in, see hal.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SIM_MOTION_CONTROL_H_
+#define _SIM_MOTION_CONTROL_H_
+
+#include "hal.h"
+
+bool mc_line (float *target, plan_line_data_t *pl_data);
+
+#endif
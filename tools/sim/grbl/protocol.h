@@ -0,0 +1,33 @@
+/*
+
+  protocol.h - host simulator stand-in, see hal.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SIM_PROTOCOL_H_
+#define _SIM_PROTOCOL_H_
+
+#include "hal.h"
+
+bool protocol_enqueue_rt_command (void (*fn)(uint_fast16_t state));
+bool protocol_buffer_synchronize (void);
+bool protocol_execute_realtime (void);
+
+#endif
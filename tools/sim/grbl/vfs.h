@@ -0,0 +1,36 @@
+/*
+
+  vfs.h - host simulator stand-in, see hal.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SIM_VFS_H_
+#define _SIM_VFS_H_
+
+#include "hal.h"
+
+typedef struct vfs_file vfs_file_t;
+
+vfs_file_t *vfs_open (const char *filename, const char *mode);
+size_t vfs_read (void *buffer, size_t size, size_t n, vfs_file_t *file);
+size_t vfs_write (const void *buffer, size_t size, size_t n, vfs_file_t *file);
+void vfs_close (vfs_file_t *file);
+
+#endif
@@ -0,0 +1,1386 @@
+/*
+
+  probe_sim.c - host simulator for the probe plugin, see probe_sim.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "probe_sim.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/report.h"
+#include "grbl/nvs_buffer.h"
+#include "grbl/motion_control.h"
+#include "grbl/vfs.h"
+#include "grbl/ngc_params.h"
+
+#define SIM_TICK_US 10          // stepper simulation time step
+#define SIM_REALTIME_US 1000    // foreground realtime processing interval while moving
+#define SIM_NVS_SIZE 2048
+#define SIM_RT_QUEUE 16
+#define SIM_PARAMS 64
+#define SIM_LINE_SIZE 256
+
+#define Alarm_AbortCycle 3
+#define Alarm_ProbeFailInitial 4
+#define Alarm_ProbeFailContact 5
+
+#define Status_GcodeUndefinedFeedRate 22
+#define Status_GcodeUnusedWords 36
+
+grbl_hal_t hal;
+grbl_t grbl;
+settings_t settings;
+system_t sys;
+parser_state_t gc_state;
+tool_data_t tool_table[N_TOOLS + 1];
+sim_t sim;
+
+struct stepper {
+    uint32_t step_count;
+};
+
+typedef struct {
+    bool touching;
+    uint64_t since;     // us, time of contact
+} contact_t;
+
+typedef enum {
+    ProbeCycle_Found = 0,
+    ProbeCycle_FailInit,
+    ProbeCycle_FailEnd,
+    ProbeCycle_Abort
+} probe_cycle_result_t;
+
+static struct {
+    uint64_t us;
+    sys_state_t state;
+    float position[N_AXIS];     // exact position along the current path, sys.position is rounded to steps
+    bool moving;
+    bool hold;
+    bool reset_pending;
+    bool probing;               // probe state monitor active
+    bool probe_away;            // probe input inverted for G38.4 and G38.5
+    plan_block_t block;         // block being executed
+    stepper_t stepper;
+    contact_t probe_contact;
+    contact_t toolsetter_contact;
+    bool input[SIM_PORTS];
+    ioport_interrupt_callback_ptr irq[SIM_PORTS];
+    void (*rt_queue[SIM_RT_QUEUE])(uint_fast16_t state);
+    uint_fast8_t rt_head, rt_tail;
+    uint8_t nvs[SIM_NVS_SIZE];
+    bool nvs_written[SIM_NVS_SIZE];
+    nvs_address_t nvs_next;
+    setting_details_t *details[4];
+    uint_fast8_t n_details;
+    float coord[N_CoordinateSystems][N_AXIS];
+    bool coord_set[N_CoordinateSystems];    // G59.3 at machine zero until set would put the fixture at the start position
+    struct {
+        uint32_t id;
+        float value;
+    } param[SIM_PARAMS];
+    uint_fast8_t n_params;
+    char *input_data;
+    size_t input_len, input_pos;
+    char *output;
+    size_t output_len, output_size;
+} core;
+
+// Output
+
+static void stream_write (const char *s)
+{
+    size_t len = strlen(s);
+
+    if(core.output_len + len + 1 > core.output_size) {
+        core.output_size = (core.output_len + len + 1) * 2;
+        core.output = realloc(core.output, core.output_size);
+    }
+
+    memcpy(core.output + core.output_len, s, len + 1);
+    core.output_len += len;
+
+    if(sim.echo)
+        fputs(s, stdout);
+}
+
+const char *sim_output (void)
+{
+    return core.output ? core.output : "";
+}
+
+bool sim_output_contains (const char *s)
+{
+    return strstr(sim_output(), s) != NULL;
+}
+
+void sim_output_clear (void)
+{
+    core.output_len = 0;
+    if(core.output)
+        *core.output = '\0';
+}
+
+void report_message (const char *msg, message_type_t type)
+{
+    stream_write("[MSG:");
+    if(type == Message_Warning)
+        stream_write("Warning: ");
+    stream_write(msg);
+    stream_write("]" ASCII_EOL);
+}
+
+static void report_alarm (uint8_t alarm)
+{
+    char buf[20];
+
+    sim.stats.alarms++;
+    sim.stats.alarm = alarm;
+    core.state = STATE_ALARM;
+
+    sprintf(buf, "ALARM:%d" ASCII_EOL, alarm);
+    stream_write(buf);
+}
+
+static status_code_t report_status_message (status_code_t status_code)
+{
+    char buf[20];
+
+    if(status_code == Status_OK)
+        stream_write("ok" ASCII_EOL);
+    else {
+        sprintf(buf, "error:%d" ASCII_EOL, (int)status_code);
+        stream_write(buf);
+    }
+
+    return status_code;
+}
+
+// Input
+
+static int16_t stream_read (void)
+{
+    return core.input_pos < core.input_len ? (int16_t)(uint8_t)core.input_data[core.input_pos++] : SERIAL_NO_DATA;
+}
+
+void sim_input (const char *lines)
+{
+    size_t len = strlen(lines);
+
+    if(core.input_pos == core.input_len)
+        core.input_pos = core.input_len = 0;
+
+    core.input_data = realloc(core.input_data, core.input_len + len + 1);
+    memcpy(core.input_data + core.input_len, lines, len + 1);
+    core.input_len += len;
+}
+
+static void stream_flush (void)
+{
+    core.input_pos = core.input_len = 0;
+}
+
+// Timing and atomics
+
+static uint32_t get_elapsed_ticks (void)
+{
+    return (uint32_t)(core.us / 1000);
+}
+
+static uint32_t get_micros (void)
+{
+    return (uint32_t)core.us;
+}
+
+static void delay_ms (uint32_t ms, void (*callback)(void))
+{
+    core.us += (uint64_t)ms * 1000;
+
+    if(callback)
+        callback();
+}
+
+static void irq_enable (void)
+{
+}
+
+static void irq_disable (void)
+{
+}
+
+static uint_fast16_t set_bits_atomic (volatile uint_fast16_t *ptr, uint_fast16_t bits)
+{
+    uint_fast16_t prev = *ptr;
+
+    *ptr |= bits;
+
+    return prev;
+}
+
+static uint_fast16_t clear_bits_atomic (volatile uint_fast16_t *ptr, uint_fast16_t bits)
+{
+    uint_fast16_t prev = *ptr;
+
+    *ptr &= ~bits;
+
+    return prev;
+}
+
+uint32_t sim_ms (void)
+{
+    return get_elapsed_ticks();
+}
+
+sys_state_t sim_state (void)
+{
+    return core.state;
+}
+
+sys_state_t state_get (void)
+{
+    return core.state;
+}
+
+// Contact model
+
+static float surface_depth (sim_surface_t *surface, float *position)
+{
+    uint_fast8_t idx;
+    float distance = 0.0f;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        distance += (position[idx] - surface->point[idx]) * surface->normal[idx];
+
+    return -distance;
+}
+
+static void contact_update (sim_surface_t *surface, contact_t *contact, float *position, float rate)
+{
+    float depth;
+
+    if(!surface->enabled) {
+        contact->touching = false;
+        return;
+    }
+
+    if((depth = surface_depth(surface, position)) >= 0.0f) {
+        if(!contact->touching) {
+            contact->touching = true;
+            contact->since = core.us;
+            if(sim.stats.contact_rate == 0.0f)
+                sim.stats.contact_rate = rate;
+        }
+        if(depth > sim.stats.penetration)
+            sim.stats.penetration = depth;
+    } else
+        contact->touching = false;
+}
+
+static bool contact_asserted (contact_t *contact)
+{
+    return contact->touching && core.us - contact->since >= (uint64_t)(sim.latency * 1000.0f);
+}
+
+static void contacts_update (float rate)
+{
+    contact_update(&sim.probe, &core.probe_contact, core.position, rate);
+    contact_update(&sim.toolsetter, &core.toolsetter_contact, core.position, rate);
+}
+
+void sim_surface_set (sim_surface_t *surface, float x, float y, float z, float nx, float ny, float nz)
+{
+    surface->enabled = true;
+    surface->point[X_AXIS] = x;
+    surface->point[Y_AXIS] = y;
+    surface->point[Z_AXIS] = z;
+    surface->normal[X_AXIS] = nx;
+    surface->normal[Y_AXIS] = ny;
+    surface->normal[Z_AXIS] = nz;
+    convert_delta_vector_to_unit_vector(surface->normal);
+    contacts_update(0.0f);
+}
+
+// Driver
+
+static void driver_pulse_start (stepper_t *stepper)
+{
+    sim.stats.pulses++;
+}
+
+static probe_state_t driver_probe_get_state (void)
+{
+    probe_state_t state = {0};
+
+    state.connected = sim.probe_connected;
+    state.triggered = contact_asserted(&core.probe_contact) || (!sim.toolsetter_aux && contact_asserted(&core.toolsetter_contact));
+    state.triggered ^= core.probe_away;
+
+    return state;
+}
+
+static void driver_probe_connected_toggle (void)
+{
+    sim.probe_connected = !sim.probe_connected;
+}
+
+static void driver_reset (void)
+{
+}
+
+static void limits_enable (bool on, axes_signals_t homing)
+{
+}
+
+// Core handlers at the end of the plugin chains.
+
+static void execute_realtime (sys_state_t state)
+{
+}
+
+static void report_options (bool newopt)
+{
+}
+
+stepper_pulse_start_ptr sim_driver_pulse_start (void)
+{
+    return driver_pulse_start;
+}
+
+probe_get_state_ptr sim_driver_probe_get_state (void)
+{
+    return driver_probe_get_state;
+}
+
+// Aux ports
+
+static bool port_level (uint8_t port)
+{
+    if(sim.toolsetter_aux && port == sim.toolsetter_port)
+        return contact_asserted(&core.toolsetter_contact);
+
+    return port < SIM_PORTS && core.input[port];
+}
+
+static int32_t wait_on_input (io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout)
+{
+    return port < SIM_PORTS ? (int32_t)port_level(port) : -1;
+}
+
+static bool register_interrupt_handler (uint8_t port, pin_irq_mode_t irq_mode, ioport_interrupt_callback_ptr interrupt_callback)
+{
+    if(port >= SIM_PORTS)
+        return false;
+
+    core.irq[port] = interrupt_callback;
+
+    return true;
+}
+
+void sim_set_input (uint8_t port, bool level)
+{
+    if(port < SIM_PORTS && core.input[port] != level) {
+        core.input[port] = level;
+        if(core.irq[port])
+            core.irq[port](port, level);
+    }
+}
+
+uint8_t ioports_available (io_port_type_t type, io_port_direction_t dir)
+{
+    return dir == Port_Input ? hal.port.num_digital_in : hal.port.num_digital_out;
+}
+
+bool ioport_claim (io_port_type_t type, io_port_direction_t dir, uint8_t *port, const char *description)
+{
+    return *port < ioports_available(type, dir);
+}
+
+bool ioport_can_claim_explicit (void)
+{
+    return true;
+}
+
+// NVS and settings, the area of an allocation that has never been written reads back as failed.
+
+static nvs_transfer_result_t memcpy_from_nvs (uint8_t *dest, nvs_address_t source, uint32_t size, bool with_checksum)
+{
+    uint32_t idx;
+
+    if(source + size > SIM_NVS_SIZE)
+        return NVS_TransferResult_Failed;
+
+    for(idx = 0; idx < size; idx++) {
+        if(!core.nvs_written[source + idx])
+            return NVS_TransferResult_Failed;
+    }
+
+    memcpy(dest, &core.nvs[source], size);
+
+    return NVS_TransferResult_OK;
+}
+
+static nvs_transfer_result_t memcpy_to_nvs (nvs_address_t dest, uint8_t *source, uint32_t size, bool with_checksum)
+{
+    if(dest + size > SIM_NVS_SIZE)
+        return NVS_TransferResult_Failed;
+
+    memcpy(&core.nvs[dest], source, size);
+    memset(&core.nvs_written[dest], true, size);
+
+    return NVS_TransferResult_OK;
+}
+
+nvs_address_t nvs_alloc (size_t size)
+{
+    nvs_address_t address = core.nvs_next ? core.nvs_next : 16; // 0 is returned on failure
+
+    if(address + size + 1 > SIM_NVS_SIZE)
+        return 0;
+
+    core.nvs_next = address + size + 1; // checksum byte
+
+    return address;
+}
+
+void settings_register (setting_details_t *details)
+{
+    if(core.n_details < sizeof(core.details) / sizeof(setting_details_t *))
+        core.details[core.n_details++] = details;
+}
+
+bool sim_setting (setting_id_t id, const char *value)
+{
+    uint_fast8_t idx, n;
+
+    for(idx = 0; idx < core.n_details; idx++) {
+        for(n = 0; n < core.details[idx]->n_settings; n++) {
+
+            const setting_detail_t *setting = &core.details[idx]->settings[n];
+
+            if(setting->id == id) {
+                switch(setting->datatype) {
+
+                    case Format_Decimal:
+                        *(float *)setting->value = strtof(value, NULL);
+                        break;
+
+                    case Format_Int16:
+                        *(uint16_t *)setting->value = (uint16_t)strtoul(value, NULL, 10);
+                        break;
+
+                    case Format_Integer:
+                        *(uint32_t *)setting->value = (uint32_t)strtoul(value, NULL, 10);
+                        break;
+
+                    default:
+                        *(uint8_t *)setting->value = (uint8_t)strtoul(value, NULL, 10);
+                        break;
+                }
+                if(core.details[idx]->save)
+                    core.details[idx]->save();
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Port and flag settings take effect on the next start, as after a controller restart.
+void sim_settings_reload (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < core.n_details; idx++) {
+        if(core.details[idx]->load)
+            core.details[idx]->load();
+    }
+
+    protocol_execute_realtime();
+}
+
+bool settings_read_coord_data (coord_system_id_t id, float (*coord_data)[N_AXIS])
+{
+    memcpy(coord_data, core.coord[id], sizeof(core.coord[id]));
+
+    return true;
+}
+
+void settings_write_coord_data (coord_system_id_t id, float (*coord_data)[N_AXIS])
+{
+    memcpy(core.coord[id], coord_data, sizeof(core.coord[id]));
+    core.coord_set[id] = true;
+}
+
+void sim_coord_set (coord_system_id_t id, const float *xyz)
+{
+    memcpy(core.coord[id], xyz, sizeof(core.coord[id]));
+    core.coord_set[id] = true;
+
+    if(gc_state.modal.coord_system.id == id)
+        memcpy(gc_state.modal.coord_system.xyz, xyz, sizeof(gc_state.modal.coord_system.xyz));
+}
+
+void settings_write_global (void)
+{
+}
+
+bool settings_write_tool_data (tool_data_t *tool_data)
+{
+    return true;
+}
+
+void system_flag_wco_change (void)
+{
+}
+
+// Conversions
+
+char *uitoa (uint32_t n)
+{
+    static char buf[12];
+
+    sprintf(buf, "%lu", (unsigned long)n);
+
+    return buf;
+}
+
+// Single buffer as in the core, a second call overwrites the result of the first.
+char *ftoa (float n, uint8_t decimal_places)
+{
+    static char buf[30];
+
+    sprintf(buf, "%.*f", (int)decimal_places, (double)n);
+
+    if(!strncmp(buf, "-0", 2) && strspn(buf + 2, ".0") == strlen(buf + 2))
+        memmove(buf, buf + 1, strlen(buf));
+
+    return buf;
+}
+
+// Decimal numbers only as in the core, no exponent or hexadecimal.
+static char *parse_number (char *s, float *value)
+{
+    char *start = s;
+
+    if(*s == '-' || *s == '+')
+        s++;
+
+    if(!(isdigit((unsigned char)*s) || (*s == '.' && isdigit((unsigned char)s[1]))))
+        return NULL;
+
+    while(isdigit((unsigned char)*s))
+        s++;
+
+    if(*s == '.')
+        while(isdigit((unsigned char)*++s));
+
+    char buf[32];
+    size_t len = min((size_t)(s - start), sizeof(buf) - 1);
+
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    *value = strtof(buf, NULL);
+
+    return s;
+}
+
+bool read_float (char *line, uint_fast8_t *char_counter, float *float_ptr)
+{
+    char *end;
+
+    if((end = parse_number(line + *char_counter, float_ptr)) == NULL)
+        return false;
+
+    *char_counter += (uint_fast8_t)(end - (line + *char_counter));
+
+    return true;
+}
+
+float convert_delta_vector_to_unit_vector (float *vector)
+{
+    uint_fast8_t idx;
+    float magnitude = 0.0f;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        magnitude += vector[idx] * vector[idx];
+
+    if((magnitude = sqrtf(magnitude)) > 0.0f) {
+        for(idx = 0; idx < N_AXIS; idx++)
+            vector[idx] /= magnitude;
+    }
+
+    return magnitude;
+}
+
+float system_convert_axis_steps_to_mpos (int32_t *steps, uint_fast8_t idx)
+{
+    return (float)steps[idx] / settings.axis[idx].steps_per_mm;
+}
+
+bool system_convert_array_steps_to_mpos (float *position, int32_t *steps)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        position[idx] = system_convert_axis_steps_to_mpos(steps, idx);
+
+    return true;
+}
+
+// Parameters and files
+
+bool ngc_param_get (uint32_t id, float *value)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < core.n_params; idx++) {
+        if(core.param[idx].id == id) {
+            *value = core.param[idx].value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ngc_param_set (uint32_t id, float value)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < core.n_params && core.param[idx].id != id; idx++);
+
+    if(idx == SIM_PARAMS)
+        return false;
+
+    if(idx == core.n_params)
+        core.n_params++;
+
+    core.param[idx].id = id;
+    core.param[idx].value = value;
+
+    return true;
+}
+
+// Files are relative to the working directory.
+vfs_file_t *vfs_open (const char *filename, const char *mode)
+{
+    return (vfs_file_t *)fopen(*filename == '/' ? filename + 1 : filename, mode);
+}
+
+size_t vfs_read (void *buffer, size_t size, size_t n, vfs_file_t *file)
+{
+    return fread(buffer, size, n, (FILE *)file);
+}
+
+size_t vfs_write (const void *buffer, size_t size, size_t n, vfs_file_t *file)
+{
+    return fwrite(buffer, size, n, (FILE *)file);
+}
+
+void vfs_close (vfs_file_t *file)
+{
+    fclose((FILE *)file);
+}
+
+// Realtime
+
+bool protocol_enqueue_rt_command (void (*fn)(uint_fast16_t state))
+{
+    uint_fast8_t next = (core.rt_head + 1) % SIM_RT_QUEUE;
+
+    if(next == core.rt_tail)
+        return false;
+
+    core.rt_queue[core.rt_head] = fn;
+    core.rt_head = next;
+
+    return true;
+}
+
+bool protocol_execute_realtime (void)
+{
+    while(core.rt_tail != core.rt_head) {
+        void (*fn)(uint_fast16_t state) = core.rt_queue[core.rt_tail];
+        core.rt_tail = (core.rt_tail + 1) % SIM_RT_QUEUE;
+        fn(core.state);
+    }
+
+    if(grbl.on_execute_realtime)
+        grbl.on_execute_realtime(core.state);
+
+    return !sys.abort;
+}
+
+// Moves are executed when queued, the buffer is always synchronized.
+bool protocol_buffer_synchronize (void)
+{
+    return !sys.abort;
+}
+
+static bool enqueue_realtime_command (char c)
+{
+    switch((uint8_t)c) {
+
+        case CMD_RESET:
+            if(core.moving) {
+                sim.stats.position_lost = true;
+                report_alarm(Alarm_AbortCycle);
+            }
+            core.reset_pending = sys.abort = true;
+            break;
+
+        case CMD_FEED_HOLD:
+            core.hold = core.moving;
+            break;
+
+        case CMD_PROBE_CONNECTED_TOGGLE:
+            if(hal.probe.connected_toggle)
+                hal.probe.connected_toggle();
+            break;
+    }
+
+    return true;
+}
+
+void sim_realtime (char c)
+{
+    grbl.enqueue_realtime_command(c);
+}
+
+// Stepper
+
+void plan_data_init (plan_line_data_t *plan_data)
+{
+    memset(plan_data, 0, sizeof(plan_line_data_t));
+}
+
+plan_block_t *plan_get_current_block (void)
+{
+    return core.moving ? &core.block : NULL;
+}
+
+static void sync_steps (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        core.position[idx] = system_convert_axis_steps_to_mpos(sys.position, idx);
+}
+
+static double host_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void pulse_start_timed (void)
+{
+    bool hooked = hal.stepper.pulse_start != driver_pulse_start;
+    double ns = host_ns();
+
+    hal.stepper.pulse_start(&core.stepper);
+
+    ns = host_ns() - ns;
+
+    if(hooked) {
+        sim.stats.hooked_pulses++;
+        sim.stats.hooked_ns += ns;
+    } else
+        sim.stats.driver_ns += ns;
+}
+
+// Executes a move from the current position, returns false if aborted. A hold, or contact while the probe
+// state monitor is active, decelerates to a stop at the acceleration along the path.
+static bool sim_motion (float *target, plan_line_data_t *pl_data)
+{
+    uint_fast8_t idx;
+    int32_t steps;
+    bool stepped, stopping = false;
+    float start[N_AXIS], unit[N_AXIS], distance, accel = 0.0f, rate = 0.0f, limit;
+    double v = 0.0, s = 0.0, dt = SIM_TICK_US * 1e-6; // float resolution is too coarse for the path position
+    uint64_t realtime = core.us + SIM_REALTIME_US;
+
+    memcpy(start, core.position, sizeof(start));
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        unit[idx] = target[idx] - start[idx];
+
+    if((distance = convert_delta_vector_to_unit_vector(unit)) == 0.0f)
+        return !sys.abort;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(unit[idx] != 0.0f) {
+            limit = settings.axis[idx].acceleration / fabsf(unit[idx]);
+            if(accel == 0.0f || limit < accel)
+                accel = limit;
+            limit = settings.axis[idx].max_rate / fabsf(unit[idx]);
+            if(rate == 0.0f || limit < rate)
+                rate = limit;
+        }
+    }
+
+    if(!pl_data->condition.rapid_motion && pl_data->feed_rate < rate)
+        rate = pl_data->feed_rate;
+
+    core.block.programmed_rate = rate;
+    core.block.condition = pl_data->condition;
+    core.moving = true;
+    core.hold = false;
+    core.state = STATE_CYCLE;
+
+    accel /= 3600.0f;   // mm/s^2
+    rate /= 60.0f;      // mm/s
+
+    while(true) {
+
+        if(stopping || core.hold) {
+            stopping = true;
+            if((v -= accel * dt) <= 0.0)
+                break;
+        } else
+            v = fmin(fmin(v + accel * dt, rate), sqrt(2.0 * accel * (distance - s)));
+
+        core.us += SIM_TICK_US;
+
+        if((s += v * dt) >= distance || (!stopping && distance - s < 1e-6))
+            s = distance;
+
+        stepped = false;
+        for(idx = 0; idx < N_AXIS; idx++) {
+            core.position[idx] = s == distance ? target[idx] : (float)(start[idx] + unit[idx] * s);
+            steps = (int32_t)lroundf(core.position[idx] * settings.axis[idx].steps_per_mm);
+            if(steps != sys.position[idx]) {
+                sys.position[idx] = steps;
+                stepped = true;
+            }
+        }
+
+        contacts_update((float)v * 60.0f);
+
+        if(stepped) {
+
+            core.stepper.step_count++;
+
+            if(sim.profile)
+                pulse_start_timed();
+            else
+                hal.stepper.pulse_start(&core.stepper);
+
+            if(core.reset_pending) // motion is stopped at once.
+                break;
+
+            if(core.probing && hal.probe.get_state().triggered) {
+                core.probing = false;
+                memcpy(sys.probe_position, sys.position, sizeof(sys.position));
+                stopping = true;
+            }
+        }
+
+        if(core.us >= realtime) {
+            realtime = core.us + SIM_REALTIME_US;
+            protocol_execute_realtime();
+        }
+
+        if(s == distance || core.reset_pending)
+            break;
+    }
+
+    if(!core.reset_pending && s != distance)
+        sync_steps(); // stopped short of the target
+
+    core.moving = core.hold = false;
+    if(core.state == STATE_CYCLE)
+        core.state = STATE_IDLE;
+
+    return !sys.abort;
+}
+
+bool mc_line (float *target, plan_line_data_t *pl_data)
+{
+    return !sys.abort && sim_motion(target, pl_data);
+}
+
+void sim_position (float *position)
+{
+    system_convert_array_steps_to_mpos(position, sys.position);
+}
+
+void sim_teleport (const float *position)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        core.position[idx] = gc_state.position[idx] = position[idx];
+        sys.position[idx] = (int32_t)lroundf(position[idx] * settings.axis[idx].steps_per_mm);
+    }
+
+    contacts_update(0.0f);
+}
+
+void sim_clear_stats (void)
+{
+    memset(&sim.stats, 0, sizeof(sim_stats_t));
+    contacts_update(0.0f);
+}
+
+// Probe cycle, same sequence as mc_probe_cycle() in the core.
+static probe_cycle_result_t mc_probe_cycle (float *target, plan_line_data_t *pl_data, bool away, bool no_error)
+{
+    uint_fast8_t idx;
+    axes_signals_t axes = {0};
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(fabsf(target[idx] - core.position[idx]) > 0.00001f)
+            axes.mask |= bit(idx);
+    }
+
+    if(grbl.on_probe_start && !grbl.on_probe_start(axes, target, pl_data))
+        return ProbeCycle_Abort;
+
+    if(!protocol_buffer_synchronize())
+        return ProbeCycle_Abort;
+
+    sys.flags.probe_succeeded = Off;
+    core.probe_away = away;
+
+    if(hal.probe.get_state().triggered) {
+        core.probe_away = false;
+        report_alarm(Alarm_ProbeFailInitial);
+        return ProbeCycle_FailInit;
+    }
+
+    sim.stats.probe_feed_rate = pl_data->feed_rate;
+    core.probing = true;
+
+    if(!mc_line(target, pl_data)) {
+        core.probing = core.probe_away = false;
+        return ProbeCycle_Abort;
+    }
+
+    if(core.probing) {
+        if(no_error)
+            memcpy(sys.probe_position, sys.position, sizeof(sys.position));
+        else
+            report_alarm(Alarm_ProbeFailContact);
+    } else
+        sys.flags.probe_succeeded = On;
+
+    core.probing = core.probe_away = false;
+
+    protocol_execute_realtime();
+
+    if(grbl.on_probe_completed)
+        grbl.on_probe_completed();
+
+    return sys.flags.probe_succeeded ? ProbeCycle_Found : ProbeCycle_FailEnd;
+}
+
+// G-code
+
+static void gc_sync_position (void)
+{
+    system_convert_array_steps_to_mpos(gc_state.position, sys.position);
+}
+
+static void gc_init (void)
+{
+    tool_data_t *tool = gc_state.tool;
+
+    memset(&gc_state, 0, sizeof(parser_state_t));
+    gc_state.modal.motion = MotionMode_Seek;
+    gc_state.tool = tool;
+    settings_read_coord_data(gc_state.modal.coord_system.id, &gc_state.modal.coord_system.xyz);
+    gc_sync_position();
+}
+
+static status_code_t gc_probe (float *target, plan_line_data_t *pl_data, motion_mode_t motion)
+{
+    bool at_g59_3, away = motion == MotionMode_ProbeAway || motion == MotionMode_ProbeAwayNoError;
+    tool_data_t *tool = sim.tool_change ? gc_state.tool : NULL;
+
+    at_g59_3 = core.coord_set[CoordinateSystem_G59_3] && hypotf(core.position[X_AXIS] - core.coord[CoordinateSystem_G59_3][X_AXIS],
+                       core.position[Y_AXIS] - core.coord[CoordinateSystem_G59_3][Y_AXIS]) <= TOOLSETTER_RADIUS;
+
+    if(grbl.on_probe_fixture)
+        grbl.on_probe_fixture(tool, at_g59_3, true);
+
+    mc_probe_cycle(target, pl_data, away, motion == MotionMode_ProbeTowardNoError || motion == MotionMode_ProbeAwayNoError);
+
+    if(grbl.on_probe_fixture)
+        grbl.on_probe_fixture(tool, at_g59_3, false);
+
+    gc_sync_position();
+
+    return Status_OK; // failures are reported by alarms
+}
+
+static status_code_t gc_execute_line (char *line)
+{
+    char letter, *end;
+    bool g53 = false, motion_set = false, m19 = false;
+    uint_fast8_t idx;
+    int32_t tool_id = -1;
+    float value, scale, target[N_AXIS], feed_rate = -1.0f;
+    parser_block_t block;
+    words_t axis_words = {0};
+    motion_mode_t motion = gc_state.modal.motion;
+    uint8_t units_imperial = gc_state.modal.units_imperial, distance_incremental = gc_state.modal.distance_incremental;
+    status_code_t status = Status_OK;
+
+    memset(&block, 0, sizeof(parser_block_t));
+
+    while(*line) {
+
+        letter = *line++;
+
+        if(!isalpha((unsigned char)letter))
+            return Status_InvalidStatement;
+
+        if(!(end = parse_number(line, &value)))
+            return Status_BadNumberFormat;
+        line = end;
+
+        switch(letter) {
+
+            case 'G':
+                switch((int)lroundf(value * 10.0f)) {
+                    case 0:   motion = MotionMode_Seek; motion_set = true; break;
+                    case 10:  motion = MotionMode_Linear; motion_set = true; break;
+                    case 200: units_imperial = true; break;
+                    case 210: units_imperial = false; break;
+                    case 382: motion = MotionMode_ProbeToward; motion_set = true; break;
+                    case 383: motion = MotionMode_ProbeTowardNoError; motion_set = true; break;
+                    case 384: motion = MotionMode_ProbeAway; motion_set = true; break;
+                    case 385: motion = MotionMode_ProbeAwayNoError; motion_set = true; break;
+                    case 530: g53 = true; break;
+                    case 900: distance_incremental = false; break;
+                    case 910: distance_incremental = true; break;
+                    default:  return Status_GcodeUnsupportedCommand;
+                }
+                break;
+
+            case 'M':
+                if(value == 2.0f || value == 30.0f)
+                    break;
+                if(value == 19.0f) {
+                    m19 = true; // spindle orientation is not modelled
+                    break;
+                }
+                if(!(hal.user_mcode.check && hal.user_mcode.check((user_mcode_t)value) != UserMCode_Ignore))
+                    return Status_GcodeUnsupportedCommand;
+                block.user_mcode = (user_mcode_t)value;
+                break;
+
+            case 'F': feed_rate = value; break;
+            case 'T': tool_id = (int32_t)value; break;
+            case 'X': block.values.xyz[X_AXIS] = value; axis_words.x = block.words.x = On; break;
+            case 'Y': block.values.xyz[Y_AXIS] = value; axis_words.y = block.words.y = On; break;
+            case 'Z': block.values.xyz[Z_AXIS] = value; axis_words.z = block.words.z = On; break;
+            case 'I': block.values.ijk[X_AXIS] = value; block.words.i = On; break;
+            case 'J': block.values.ijk[Y_AXIS] = value; block.words.j = On; break;
+            case 'K': block.values.ijk[Z_AXIS] = value; block.words.k = On; break;
+            case 'D': block.values.d = value; block.words.d = On; break;
+            case 'E': block.values.e = value; block.words.e = On; break;
+            case 'H': block.values.h = value; block.words.h = On; break;
+            case 'L': block.values.l = (uint8_t)value; block.words.l = On; break;
+            case 'P': block.values.p = value; block.words.p = On; break;
+            case 'Q': block.values.q = value; block.words.q = On; break;
+            case 'R': block.values.r = value; block.words.r = On; break;
+            case 'S': block.values.s = value; block.words.s = On; break;
+            default: return Status_GcodeUnsupportedCommand;
+        }
+    }
+
+    if(m19)
+        block.words.r = Off;
+
+    if(block.user_mcode) {
+        if(hal.user_mcode.validate && (status = hal.user_mcode.validate(&block, NULL)) != Status_OK)
+            return status;
+        if(block.words.mask & ~axis_words.mask)
+            return Status_GcodeUnusedWords;
+    } else if(block.words.mask & ~axis_words.mask)
+        return Status_GcodeUnusedWords;
+
+    if(core.state == STATE_ALARM)
+        return Status_SystemGClock;
+
+    if(tool_id >= 0) {
+        if(tool_id > N_TOOLS)
+            return Status_GcodeValueOutOfRange;
+        tool_table[tool_id].tool_id = (uint32_t)tool_id;
+        gc_state.tool = &tool_table[tool_id];
+        if(grbl.on_tool_selected)
+            grbl.on_tool_selected(gc_state.tool);
+    }
+
+    gc_state.modal.units_imperial = units_imperial;
+    gc_state.modal.distance_incremental = distance_incremental;
+    scale = units_imperial ? 25.4f : 1.0f;
+
+    if(feed_rate >= 0.0f)
+        gc_state.feed_rate = feed_rate * scale;
+
+    if(motion_set || axis_words.mask)
+        gc_state.modal.motion = motion;
+
+    if(block.user_mcode && hal.user_mcode.execute)
+        hal.user_mcode.execute(core.state, &block);
+
+    if(axis_words.mask && !sys.abort) {
+
+        plan_line_data_t plan_data;
+
+        bool axis[N_AXIS] = { axis_words.x, axis_words.y, axis_words.z };
+
+        for(idx = 0; idx < N_AXIS; idx++) {
+            if(!axis[idx])
+                target[idx] = gc_state.position[idx];
+            else if(g53)
+                target[idx] = block.values.xyz[idx] * scale;
+            else if(gc_state.modal.distance_incremental)
+                target[idx] = gc_state.position[idx] + block.values.xyz[idx] * scale;
+            else
+                target[idx] = block.values.xyz[idx] * scale + gc_state.modal.coord_system.xyz[idx] + gc_state.g92_coord_offset[idx] + gc_state.tool_length_offset[idx];
+        }
+
+        plan_data_init(&plan_data);
+        plan_data.feed_rate = gc_state.feed_rate;
+
+        switch(motion) {
+
+            case MotionMode_Seek:
+                plan_data.condition.rapid_motion = On;
+                // fall through
+            case MotionMode_Linear:
+                if(motion == MotionMode_Linear && gc_state.feed_rate == 0.0f)
+                    return Status_GcodeUndefinedFeedRate;
+                if(mc_line(target, &plan_data))
+                    memcpy(gc_state.position, target, sizeof(target));
+                break;
+
+            default:
+                if(gc_state.feed_rate == 0.0f)
+                    return Status_GcodeUndefinedFeedRate;
+                status = gc_probe(target, &plan_data, motion);
+                break;
+        }
+    }
+
+    return status;
+}
+
+// $ commands: $X, $<setting>=<value> and commands registered by plugins.
+static status_code_t system_execute_line (char *line)
+{
+    char *args;
+    uint_fast8_t idx;
+    sys_commands_t *commands;
+
+    if(!strcmp(line, "X")) {
+        if(core.state == STATE_ALARM) {
+            core.state = STATE_IDLE;
+            report_message("Caution: Unlocked", Message_Info);
+        }
+        return Status_OK;
+    }
+
+    if((args = strchr(line, '=')))
+        *args++ = '\0';
+
+    if(isdigit((unsigned char)*line))
+        return args && sim_setting((setting_id_t)atoi(line), args) ? Status_OK : Status_InvalidStatement;
+
+    for(commands = grbl.on_get_commands ? grbl.on_get_commands() : NULL; commands; commands = commands->on_get_commands ? commands->on_get_commands() : NULL) {
+        for(idx = 0; idx < commands->n_commands; idx++) {
+            if(!strcmp(commands->commands[idx].command, line))
+                return commands->commands[idx].execute(core.state, args);
+        }
+    }
+
+    return Status_InvalidStatement;
+}
+
+static status_code_t execute_line (char *line)
+{
+    char *s, *d;
+
+    for(s = d = line; *s; s++) {
+        if(*line != '$' && *s == '(')
+            break; // comment
+        if(*line == '$' || !isspace((unsigned char)*s))
+            *d++ = *line == '$' ? *s : (char)toupper((unsigned char)*s);
+    }
+    *d = '\0';
+
+    if(*line == '\0')
+        return Status_OK;
+
+    return *line == '$' ? system_execute_line(line + 1) : gc_execute_line(line);
+}
+
+// Reset, executed by the protocol loop after the stepper has stopped.
+static void sim_reset (void)
+{
+    stream_flush();
+
+    hal.driver_reset();
+
+    core.reset_pending = sys.abort = false;
+    core.probing = core.probe_away = false;
+    if(core.state != STATE_ALARM)
+        core.state = STATE_IDLE;
+
+    sim.stats.resets++;
+    sync_steps();
+    gc_init();
+
+    stream_write("GrblHAL 1.1f ['$' or '$HELP' for help]" ASCII_EOL);
+    if(core.state == STATE_ALARM)
+        report_message("'$H'|'$X' to unlock", Message_Info);
+
+    protocol_execute_realtime();
+}
+
+// Processes input until there is no more from the stream or a line runner.
+void sim_run (void)
+{
+    char line[SIM_LINE_SIZE];
+    size_t len = 0;
+    int16_t c;
+    stream_read_ptr reader;
+
+    while(true) {
+
+        if(sys.abort) {
+            sim_reset();
+            len = 0;
+        }
+
+        protocol_execute_realtime();
+
+        reader = hal.stream.read;
+
+        if((c = reader()) == SERIAL_NO_DATA) {
+            if(reader == hal.stream.read && !sys.abort && core.rt_tail == core.rt_head)
+                break; // a line runner that ends restores the stream, read again if it did
+            continue;
+        }
+
+        if(c == '\n' || c == '\r') {
+            if(len) {
+                status_code_t status;
+                line[len] = '\0';
+                len = 0;
+                status = execute_line(line);
+                if(!sys.abort)
+                    grbl.report.status_message(status);
+            }
+        } else if(len < SIM_LINE_SIZE - 1)
+            line[len++] = (char)c;
+    }
+}
+
+// Runs a single line and anything it starts, returns the status reported for it.
+status_code_t sim_line (const char *line)
+{
+    size_t start = core.output_len;
+    const char *s;
+    int error;
+
+    sim_input(line);
+    sim_input("\n");
+    sim_run();
+
+    for(s = sim_output() + start; *s; s = strchr(s, '\n') ? strchr(s, '\n') + 1 : s + strlen(s)) {
+        if(!strncmp(s, "ok", 2))
+            return Status_OK;
+        if(sscanf(s, "error:%d", &error) == 1)
+            return (status_code_t)error;
+    }
+
+    return Status_Unhandled; // no response, e.g. aborted by a reset
+}
+
+void sim_init (void (*plugin_init)(void))
+{
+    uint_fast8_t idx;
+
+    memset(&hal, 0, sizeof(hal));
+    memset(&grbl, 0, sizeof(grbl));
+    memset(&settings, 0, sizeof(settings));
+    memset(&sys, 0, sizeof(sys));
+    memset(&gc_state, 0, sizeof(gc_state));
+    memset(tool_table, 0, sizeof(tool_table));
+
+    hal.get_elapsed_ticks = get_elapsed_ticks;
+    hal.get_micros = get_micros;
+    hal.delay_ms = delay_ms;
+    hal.irq_enable = irq_enable;
+    hal.irq_disable = irq_disable;
+    hal.set_bits_atomic = set_bits_atomic;
+    hal.clear_bits_atomic = clear_bits_atomic;
+    hal.driver_reset = driver_reset;
+    hal.stepper.pulse_start = driver_pulse_start;
+    hal.probe.get_state = driver_probe_get_state;
+    hal.probe.connected_toggle = driver_probe_connected_toggle;
+    hal.limits.enable = limits_enable;
+    hal.port.num_digital_in = hal.port.num_digital_out = SIM_PORTS;
+    hal.port.wait_on_input = wait_on_input;
+    hal.port.register_interrupt_handler = register_interrupt_handler;
+    hal.stream.read = stream_read;
+    hal.stream.write = stream_write;
+    hal.nvs.memcpy_from_nvs = memcpy_from_nvs;
+    hal.nvs.memcpy_to_nvs = memcpy_to_nvs;
+
+    grbl.enqueue_realtime_command = enqueue_realtime_command;
+    grbl.report.status_message = report_status_message;
+    grbl.on_execute_realtime = execute_realtime;
+    grbl.on_report_options = report_options;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        settings.axis[idx].steps_per_mm = 200.0f;
+        settings.axis[idx].max_rate = 3000.0f;
+        settings.axis[idx].acceleration = 500.0f * 3600.0f; // 500 mm/s^2
+    }
+    settings.tool_change.seek_rate = 500.0f;
+    settings.tool_change.feed_rate = 50.0f;
+    settings.tool_change.pulloff_rate = 100.0f;
+
+    sim.probe_connected = true;
+
+    if(plugin_init)
+        plugin_init();
+
+    gc_init();
+    sim_settings_reload();
+}
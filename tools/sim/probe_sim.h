@@ -0,0 +1,102 @@
+/*
+
+  probe_sim.h - host simulator for the probe plugin
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Stands in for the grblHAL core and driver so probe_plugin.c can be run unmodified on the host:
+
+    Stepper: moves are executed one at a time in 10 us ticks with trapezoidal velocity profiles limited by
+             the axis max rate and acceleration settings. hal.stepper.pulse_start is called for every step event.
+             A reset stops motion at once, the position is then lost as on a real machine.
+    Probe:   the stylus and the toolsetter are modelled as half spaces, the input is asserted the trigger
+             latency after the stylus or tool enters one. Penetration past the surface is recorded as overtravel.
+    Core:    G0, G1, G38.2-G38.5, G20/G21, G53, G90/G91, F, T and user M-codes are parsed and executed in the
+             same order as the core does: probe fixture, on_probe_start, initial trigger check, probe motion
+             with the stop decelerated at the axis acceleration, on_probe_completed and probe fixture off.
+
+  Time only advances while moving and in hal.delay_ms(), the simulation is deterministic.
+
+*/
+
+#ifndef _PROBE_SIM_H_
+#define _PROBE_SIM_H_
+
+#include "driver.h"
+
+#define SIM_PORTS 4 // aux inputs, the toolsetter and the probe connected input are among them
+
+typedef struct {
+    bool enabled;
+    float point[N_AXIS];    // machine position of a point on the surface
+    float normal[N_AXIS];   // unit normal pointing away from the material
+} sim_surface_t;
+
+typedef struct {
+    uint64_t pulses;        // step events that reached the driver
+    uint32_t resets;
+    uint32_t alarms;
+    uint8_t alarm;          // last alarm code
+    bool position_lost;     // motion was stopped by a reset without deceleration
+    float penetration;      // max distance moved into a surface
+    float contact_rate;     // mm/min at first contact
+    float probe_feed_rate;  // feed rate of the last probe cycle after on_probe_start
+    uint64_t hooked_pulses; // step events with hal.stepper.pulse_start hooked by a plugin
+    double hooked_ns;       // host time spent in hal.stepper.pulse_start, sim_t profile only
+    double driver_ns;       // as above for step events that went to the driver directly
+} sim_stats_t;
+
+typedef struct {
+    sim_surface_t probe;        // touched by the probe stylus
+    sim_surface_t toolsetter;   // touched by the tool, wired to the probe input unless toolsetter_aux is set
+    bool toolsetter_aux;        // toolsetter wired to aux input toolsetter_port
+    uint8_t toolsetter_port;
+    float latency;              // ms from contact to input asserted
+    bool probe_connected;       // driver probe connected input
+    bool tool_change;           // G38 cycles are run as a tool change measurement, the fixture gets the current tool
+    bool echo;                  // copy controller output to stdout
+    bool profile;               // time hal.stepper.pulse_start calls
+    sim_stats_t stats;
+} sim_t;
+
+extern sim_t sim;
+
+void sim_init (void (*plugin_init)(void));
+void sim_run (void);
+status_code_t sim_line (const char *line);
+void sim_input (const char *lines);
+void sim_realtime (char c);
+bool sim_setting (setting_id_t id, const char *value);
+void sim_settings_reload (void);
+void sim_set_input (uint8_t port, bool level);
+void sim_position (float *position);
+void sim_teleport (const float *position);
+void sim_coord_set (coord_system_id_t id, const float *xyz);
+void sim_surface_set (sim_surface_t *surface, float x, float y, float z, float nx, float ny, float nz);
+void sim_clear_stats (void);
+uint32_t sim_ms (void);
+sys_state_t sim_state (void);
+
+const char *sim_output (void);
+bool sim_output_contains (const char *s);
+void sim_output_clear (void);
+
+stepper_pulse_start_ptr sim_driver_pulse_start (void);
+probe_get_state_ptr sim_driver_probe_get_state (void);
+
+#endif
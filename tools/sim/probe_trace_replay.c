@@ -0,0 +1,82 @@
+/*
+
+  probe_trace_replay.c - replays a field $PROBETRACE dump through the plugin on the host simulator
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Usage: probe_trace_replay [-v] [-l <latency ms>] < console.log
+
+    -v  report every probe cycle, not only those with a different outcome, and the protection trip positions.
+    -l  probe trigger latency, the recorded trigger positions are reproduced with it.
+
+  Exits with 1 if a recorded trigger outcome or protection trip was not reproduced.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "probe_sim.h"
+#include "replay.h"
+
+int main (int argc, char **argv)
+{
+    int idx;
+    char line[256];
+    bool verbose = false;
+    float latency = 0.0f;
+    replay_stats_t *stats;
+
+    for(idx = 1; idx < argc; idx++) {
+        if(!strcmp(argv[idx], "-v"))
+            verbose = true;
+        else if(!strcmp(argv[idx], "-l") && idx + 1 < argc)
+            latency = strtof(argv[++idx], NULL);
+        else {
+            fprintf(stderr, "usage: probe_trace_replay [-v] [-l <latency ms>] < console.log\n");
+            return 2;
+        }
+    }
+
+    replay_init(latency, verbose);
+
+    while(fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if(!replay_line(line))
+            return 2;
+    }
+
+    replay_end();
+
+    stats = replay_stats();
+
+    printf("records: %u, %u malformed\n", stats->records, stats->malformed);
+    printf("probe cycles: %u replayed, %u without a trigger record\n", stats->cycles, stats->incomplete);
+    printf("triggered: %u recorded, %u simulated, %u mismatched, max position error %.3f mm\n",
+            stats->triggered, stats->sim_triggered, stats->mismatches, stats->trigger_error);
+    printf("feed rate limited by overtravel: %u cycles\n", stats->clamped);
+    printf("protection trips: %u recorded, %u simulated\n", stats->trips, stats->sim_trips);
+    printf("resets: %u recorded, %u simulated\n", stats->resets, sim.stats.resets);
+    printf("hal.stepper.pulse_start: %llu calls hooked by the plugin %.1f ns/call, %llu calls to the driver only %.1f ns/call\n",
+            (unsigned long long)sim.stats.hooked_pulses, sim.stats.hooked_pulses ? sim.stats.hooked_ns / (double)sim.stats.hooked_pulses : 0.0,
+             (unsigned long long)(sim.stats.pulses - sim.stats.hooked_pulses),
+              sim.stats.pulses > sim.stats.hooked_pulses ? sim.stats.driver_ns / (double)(sim.stats.pulses - sim.stats.hooked_pulses) : 0.0);
+
+    return replay_matched() ? 0 : 1;
+}
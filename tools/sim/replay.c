@@ -0,0 +1,464 @@
+/*
+
+  replay.c - replays $PROBETRACE dumps through the host simulator, see replay.h
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "probe_sim.h"
+#include "probe_plugin.h"
+#include "probe_trace.h"
+#include "replay.h"
+
+#define REPLAY_EXT_PORT 3   // simulator aux input used as the probe connected pin
+
+// Connected state bits as recorded, see probe_connected_flags_t in probe_plugin.c.
+#define CONNECTED_TOGGLE  (1 << 0)
+#define CONNECTED_EXT_PIN (1 << 2)
+
+// Plugin flags setting bits, see probe_protect_flags_t in probe_plugin.c.
+#define FLAG_EXT_PIN     (1 << 2)
+#define FLAG_EXT_PIN_INV (1 << 3)
+
+void probe_protect_init (void);
+
+typedef struct {
+    bool started;
+    probe_trace_rec_t start;
+    probe_trace_rec_t target;
+} cycle_t;
+
+static struct {
+    bool verbose;
+    float latency;
+    uint8_t connected;      // last recorded connected state
+    uint8_t ext_port;
+    uint8_t flags;
+    uint32_t resets;        // simulator resets matched by recorded resets
+    bool reset_pending;
+    cycle_t cycle;
+    replay_stats_t stats;
+} replay;
+
+static void on_probe_event (const probe_result_t *result)
+{
+    if(result->event == ProbeEvent_Tripped) {
+        replay.stats.sim_trips++;
+        if(replay.verbose)
+            printf("simulated PROBE PROTECTED! at %.3f,%.3f,%.3f\n", result->position[X_AXIS], result->position[Y_AXIS], result->position[Z_AXIS]);
+    }
+}
+
+static int hex_value (char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+static uint32_t get_u32 (const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Same as in tools/probe_trace_decode.c, decoded from little endian independent of the host.
+static bool decode_record (const char *hex, probe_trace_rec_t *rec)
+{
+    uint8_t data[sizeof(probe_trace_rec_t)];
+    uint32_t u;
+    int idx, hi, lo;
+
+    for(idx = 0; idx < (int)sizeof(data); idx++) {
+        if((hi = hex_value(hex[idx * 2])) < 0 || (lo = hex_value(hex[idx * 2 + 1])) < 0)
+            return false;
+        data[idx] = (uint8_t)((hi << 4) | lo);
+    }
+
+    if(hex[sizeof(data) * 2] != ']')
+        return false;
+
+    rec->type = data[0];
+    rec->probe_id = data[1];
+    rec->flags = data[2];
+    rec->cycle = data[3];
+    rec->ms = get_u32(&data[4]);
+    u = get_u32(&data[8]);
+    memcpy(&rec->feed_rate, &u, sizeof(float));
+    for(idx = 0; idx < PROBE_TRACE_AXES; idx++)
+        rec->position[idx] = (int32_t)get_u32(&data[12 + idx * 4]);
+
+    return true;
+}
+
+static void rec_position (const probe_trace_rec_t *rec, float *position)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        position[idx] = idx < PROBE_TRACE_AXES ? (float)rec->position[idx] / 1000.0f : 0.0f;
+}
+
+static status_code_t command (const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static status_code_t command (const char *fmt, ...)
+{
+    char line[128];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    return sim_line(line);
+}
+
+static void unlock (void)
+{
+    if(sim_state() == STATE_ALARM)
+        sim_line("$X");
+}
+
+static bool inside (const float *position)
+{
+    uint_fast8_t idx;
+    float distance = 0.0f;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        distance += (position[idx] - sim.probe.point[idx]) * sim.probe.normal[idx];
+
+    return sim.probe.enabled && distance <= 0.0f;
+}
+
+static bool in_surface (void)
+{
+    float position[N_AXIS];
+
+    sim_position(position);
+
+    return inside(position);
+}
+
+// Brings the simulator to the recorded start position. A start position still in the last surface is
+// where the last cycle stopped on the machine, it is not moved to since the simulated stop differs.
+static void move_to (const float *position)
+{
+    uint_fast8_t idx;
+    float current[N_AXIS];
+    bool move = false;
+
+    sim_position(current);
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        move |= fabsf(current[idx] - position[idx]) > 0.001f;
+
+    if(!in_surface())
+        sim.probe.enabled = false;
+    else if(inside(position))
+        move = false;
+
+    if(move) {
+        unlock();
+        command("G53G0X%.3fY%.3fZ%.3f", position[X_AXIS], position[Y_AXIS], position[Z_AXIS]);
+    }
+}
+
+// Replays the unrecorded move that tripped protection. With the stylus still deflected it is moved out
+// of the surface, else an obstacle is placed at the trip position and approached at the rapid rate.
+// Protection must be armed in the replayed plugin state for the trip to be reproduced.
+static void replay_trip (const float *position)
+{
+    uint_fast8_t idx;
+    float current[N_AXIS], dir[N_AXIS], setback;
+
+    unlock();
+
+    if(in_surface())
+        command("G91G0X%.3fY%.3fZ%.3f", sim.probe.normal[X_AXIS], sim.probe.normal[Y_AXIS], sim.probe.normal[Z_AXIS]);
+
+    else {
+
+        sim_position(current);
+
+        for(idx = 0; idx < N_AXIS; idx++)
+            dir[idx] = position[idx] - current[idx];
+
+        if(convert_delta_vector_to_unit_vector(dir) == 0.0f)
+            return;
+
+        setback = settings.axis[X_AXIS].max_rate / 60000.0f * replay.latency;
+        sim_surface_set(&sim.probe, position[X_AXIS] - dir[X_AXIS] * setback, position[Y_AXIS] - dir[Y_AXIS] * setback, position[Z_AXIS] - dir[Z_AXIS] * setback,
+                         -dir[X_AXIS], -dir[Y_AXIS], -dir[Z_AXIS]);
+
+        command("G53G0X%.3fY%.3fZ%.3f", position[X_AXIS] + dir[X_AXIS], position[Y_AXIS] + dir[Y_AXIS], position[Z_AXIS] + dir[Z_AXIS]);
+    }
+
+    command("G90");
+
+    sim.probe.enabled = false; // cleared before the next recorded move, as by the operator on the machine.
+}
+
+static void replay_cycle (const probe_trace_rec_t *start, const probe_trace_rec_t *target, const probe_trace_rec_t *trigger)
+{
+    uint_fast8_t idx;
+    bool away, succeeded = !!(trigger->flags & ProbeTraceFlag_Succeeded), sim_succeeded = false;
+    float from[N_AXIS], to[N_AXIS], at[N_AXIS], dir[N_AXIS], current[N_AXIS], error = 0.0f;
+
+    rec_position(start, from);
+    rec_position(target, to);
+    rec_position(trigger, at);
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        dir[idx] = to[idx] - from[idx];
+
+    if(convert_delta_vector_to_unit_vector(dir) == 0.0f)
+        return;
+
+    move_to(from);
+    unlock();
+
+    sim.tool_change = start->probe_id == ProbeTraceId_Toolsetter;
+
+    if(!(away = in_surface())) {
+        sim.probe.enabled = false;
+        if(succeeded) {
+            float setback = start->feed_rate / 60000.0f * replay.latency;
+            sim_surface_set(&sim.probe, at[X_AXIS] - dir[X_AXIS] * setback, at[Y_AXIS] - dir[Y_AXIS] * setback, at[Z_AXIS] - dir[Z_AXIS] * setback,
+                             -dir[X_AXIS], -dir[Y_AXIS], -dir[Z_AXIS]);
+        }
+    }
+
+    sim_position(current);
+    sim.stats.probe_feed_rate = 0.0f;
+
+    if(command("G91G38.%dX%.3fY%.3fZ%.3fF%.1f", away ? 5 : 3, to[X_AXIS] - current[X_AXIS], to[Y_AXIS] - current[Y_AXIS],
+                to[Z_AXIS] - current[Z_AXIS], start->feed_rate) == Status_OK && sim.stats.probe_feed_rate > 0.0f) {
+
+        sim_succeeded = sys.flags.probe_succeeded;
+
+        for(idx = 0; idx < PROBE_TRACE_AXES; idx++)
+            error += powf((float)sys.probe_position[idx] / settings.axis[idx].steps_per_mm - at[idx], 2.0f);
+        error = sqrtf(error);
+    }
+
+    command("G90");
+
+    replay.stats.cycles++;
+    if(succeeded)
+        replay.stats.triggered++;
+    if(sim_succeeded)
+        replay.stats.sim_triggered++;
+    if(succeeded != sim_succeeded)
+        replay.stats.mismatches++;
+    else if(succeeded && error > replay.stats.trigger_error)
+        replay.stats.trigger_error = error;
+    if(sim.stats.probe_feed_rate > 0.0f && sim.stats.probe_feed_rate < start->feed_rate * 0.999f)
+        replay.stats.clamped++;
+
+    if(replay.verbose || succeeded != sim_succeeded)
+        printf("cycle %u%s%s: recorded %.3f,%.3f,%.3f %s, simulated %s, error %.3f mm, feed %.1f/%.1f\n", start->cycle,
+                away ? " (release)" : "", start->probe_id == ProbeTraceId_Toolsetter ? " (toolsetter)" : "",
+                 at[X_AXIS], at[Y_AXIS], at[Z_AXIS], succeeded ? "ok" : "failed", sim_succeeded ? "ok" : "failed",
+                  error, start->feed_rate, sim.stats.probe_feed_rate);
+}
+
+// The reset of a trip is recorded before the trip, it is replayed when the next record is not the trip.
+static void reset_flush (void)
+{
+    if(replay.reset_pending) {
+        replay.reset_pending = false;
+        if(sim.stats.resets == replay.resets) {
+            sim_realtime(CMD_RESET);
+            sim_run();
+        }
+        replay.resets++;
+    }
+}
+
+static void replay_record (const probe_trace_rec_t *rec)
+{
+    float position[N_AXIS];
+
+    if(rec->type != ProbeTrace_Tripped)
+        reset_flush();
+
+    switch(rec->type) {
+
+        case ProbeTrace_Start:
+            if(replay.cycle.started)
+                replay.stats.incomplete++;
+            replay.cycle.started = true;
+            replay.cycle.start = *rec;
+            replay.cycle.target = *rec;
+            break;
+
+        case ProbeTrace_Target:
+            replay.cycle.target = *rec;
+            break;
+
+        case ProbeTrace_Trigger:
+            if(replay.cycle.started && replay.cycle.start.cycle == rec->cycle)
+                replay_cycle(&replay.cycle.start, &replay.cycle.target, rec);
+            replay.cycle.started = false;
+            break;
+
+        case ProbeTrace_Connected:
+            if((rec->flags ^ replay.connected) & CONNECTED_EXT_PIN)
+                sim_set_input(replay.ext_port, !!(rec->flags & CONNECTED_EXT_PIN) != !!(replay.flags & FLAG_EXT_PIN_INV));
+            if((rec->flags ^ replay.connected) & CONNECTED_TOGGLE)
+                sim_realtime(CMD_PROBE_CONNECTED_TOGGLE);
+            sim_run();
+            replay.connected = rec->flags;
+            break;
+
+        case ProbeTrace_ToolSelected:
+            unlock();
+            command("T%lu", (unsigned long)rec->tool_id);
+            break;
+
+        case ProbeTrace_MCode:
+            unlock();
+            command("M%d", 400 + rec->flags);
+            break;
+
+        case ProbeTrace_Tripped:
+            replay.stats.trips++;
+            rec_position(rec, position);
+            if(replay.verbose)
+                printf("recorded PROBE PROTECTED! at %.3f,%.3f,%.3f\n", position[X_AXIS], position[Y_AXIS], position[Z_AXIS]);
+            replay_trip(position);
+            reset_flush();
+            break;
+
+        case ProbeTrace_Reset:
+            replay.stats.resets++;
+            replay.reset_pending = true;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void replay_init (float latency, bool verbose)
+{
+    char value[8];
+
+    memset(&replay, 0, sizeof(replay));
+
+    replay.verbose = verbose;
+    replay.latency = latency;
+    replay.ext_port = REPLAY_EXT_PORT;
+    replay.flags = FLAG_EXT_PIN;
+
+    sim_init(probe_protect_init);
+    probe_plugin_subscribe(on_probe_event);
+
+    sim.latency = latency;
+    sim.profile = true;
+
+    snprintf(value, sizeof(value), "%d", REPLAY_EXT_PORT);
+    sim_setting(Setting_UserDefined_7, value);
+    snprintf(value, sizeof(value), "%d", FLAG_EXT_PIN);
+    sim_setting(Setting_UserDefined_9, value);
+    sim_settings_reload();
+
+    sim_clear_stats();
+}
+
+// Applies $<plugin setting>=<value> lines, they take effect at once as after a restart.
+static bool replay_setting (const char *line)
+{
+    char *end;
+    unsigned long id = strtoul(line + 1, &end, 10);
+
+    if(*end != '=' || id < Setting_UserDefined_0 || id > Setting_UserDefined_9 || !sim_setting((setting_id_t)id, end + 1))
+        return false;
+
+    if(id == Setting_UserDefined_7)
+        replay.ext_port = (uint8_t)atoi(end + 1);
+    else if(id == Setting_UserDefined_9)
+        replay.flags = (uint8_t)atoi(end + 1);
+
+    sim_settings_reload();
+
+    return true;
+}
+
+// Returns false if the trace can not be replayed.
+bool replay_line (const char *line)
+{
+    const char *s;
+    probe_trace_rec_t rec;
+
+    if(!strncmp(line, "[PRBTRCINFO:", 12)) {
+        int version = 0, size = 0;
+        if(sscanf(line + 12, "%d,%d", &version, &size) != 2 || version != PROBE_TRACE_VERSION || size != (int)sizeof(probe_trace_rec_t)) {
+            fprintf(stderr, "unsupported trace version %d or record size %d\n", version, size);
+            return false;
+        }
+        replay.cycle.started = false;
+        return true;
+    }
+
+    if(*line == '$') {
+        replay_setting(line);
+        return true;
+    }
+
+    if((s = strstr(line, "[PRBTRC:")) == NULL)
+        return true;
+
+    if(decode_record(s + 8, &rec)) {
+        replay.stats.records++;
+        replay_record(&rec);
+    } else
+        replay.stats.malformed++;
+
+    return true;
+}
+
+void replay_end (void)
+{
+    reset_flush();
+
+    if(replay.cycle.started)
+        replay.stats.incomplete++;
+    replay.cycle.started = false;
+}
+
+replay_stats_t *replay_stats (void)
+{
+    return &replay.stats;
+}
+
+// True if the replay reproduced the recorded trigger outcomes and protection trips.
+bool replay_matched (void)
+{
+    return replay.stats.mismatches == 0 && replay.stats.trips == replay.stats.sim_trips;
+}
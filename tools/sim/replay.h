@@ -0,0 +1,69 @@
+/*
+
+  replay.h - replays $PROBETRACE dumps through the host simulator
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Records are fed to the plugin hooks in the recorded order:
+
+    Tool selected:  T<n>, a toolsetter cycle is run as a tool change measurement with this tool.
+    M-code:         M401/M402.
+    Connected:      probe connected pin edges are driven on the simulator aux input, toggles as CMD_PROBE_CONNECTED_TOGGLE.
+    Probe cycle:    G53 rapid to the recorded start followed by an incremental G38.3 to the recorded target.
+                    For a succeeded cycle a surface is placed through the recorded trigger position normal to the
+                    move, set back by the travel during the trigger latency. A cycle started with the stylus still
+                    in the last surface is run as a G38.5 release. The surface is removed once the stylus is clear.
+    Tripped:        the stylus is moved out of the surface if still deflected, else an obstacle is placed at the
+                    recorded position and approached at the rapid rate. Only trips while protection is armed are reproduced.
+    Reset:          a reset is requested unless the simulated controller has reset without a matching record.
+
+  Moves between probe cycles are not recorded, they are replayed as a single rapid to the next start position.
+  Protection trips during the replay are counted and compared with the recorded ones.
+  Lines in the log setting plugin options, e.g. from $$, are applied as they appear.
+
+*/
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t records;
+    uint32_t malformed;
+    uint32_t cycles;            // probe cycles replayed
+    uint32_t incomplete;        // recorded cycles without a trigger record, e.g. failed on the initial check
+    uint32_t triggered;         // recorded cycles that succeeded
+    uint32_t sim_triggered;     // replayed cycles that succeeded
+    uint32_t mismatches;        // replayed cycles with a different outcome
+    float trigger_error;        // mm, max distance between the recorded and the simulated trigger position
+    uint32_t clamped;           // replayed cycles run at a lower feed rate than recorded
+    uint32_t trips;             // recorded protection trips
+    uint32_t sim_trips;         // protection trips during the replay
+    uint32_t resets;            // recorded resets
+} replay_stats_t;
+
+void replay_init (float latency, bool verbose);
+bool replay_line (const char *line);
+void replay_end (void);
+replay_stats_t *replay_stats (void);
+bool replay_matched (void);
+
+#endif
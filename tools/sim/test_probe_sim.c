@@ -0,0 +1,771 @@
+/*
+
+  test_probe_sim.c - probe plugin regression tests run on the host simulator
+
+  Part of grblHAL
+
+  Copyright (c) 2026 probe_plugin contributors
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+  Usage: test_probe_sim [-v] [test name]
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "probe_sim.h"
+#include "probe_plugin.h"
+#include "probe_fit.h"
+#include "replay.h"
+
+#define STEP 0.005f // mm, one step at the simulator default of 200 steps/mm
+
+#define CHECK(cond) do { if(!(cond)) { \
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n--- controller output ---\n%s\n", __FILE__, __LINE__, #cond, sim_output()); \
+    exit(1); } } while(0)
+
+void probe_protect_init (void);
+
+static bool verbose = false;
+
+static struct {
+    uint32_t tripped;
+    uint32_t completed;
+    bool redirected;    // get_state redirected when the probe cycle completed
+    void (*on_completed)(uint32_t count); // called with the count of completed probe cycles
+} events;
+
+static void on_probe_event (const probe_result_t *result)
+{
+    switch(result->event) {
+
+        case ProbeEvent_Tripped:
+            events.tripped++;
+            break;
+
+        case ProbeEvent_Completed:
+            events.completed++;
+            events.redirected = hal.probe.get_state != sim_driver_probe_get_state();
+            if(events.on_completed)
+                events.on_completed(events.completed);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void setup (void)
+{
+    sim.echo = verbose;
+    sim_init(probe_protect_init);
+    probe_plugin_subscribe(on_probe_event);
+}
+
+static bool pulse_hooked (void)
+{
+    return hal.stepper.pulse_start != sim_driver_pulse_start();
+}
+
+static float position_z (void)
+{
+    float position[N_AXIS];
+
+    sim_position(position);
+
+    return position[Z_AXIS];
+}
+
+// Surface below the stylus at z, approached from above.
+static void floor_at (float z)
+{
+    sim_surface_set(&sim.probe, 0.0f, 0.0f, z, 0.0f, 0.0f, 1.0f);
+}
+
+// The stepper hook is only installed while a probe is connected and the original pointers are put back.
+static void test_hook_restore (void)
+{
+    setup();
+
+    CHECK(!pulse_hooked());
+    CHECK(hal.probe.get_state == sim_driver_probe_get_state());
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(pulse_hooked());
+
+    CHECK(sim_line("M402") == Status_OK);
+    CHECK(!pulse_hooked());
+    CHECK(hal.probe.get_state == sim_driver_probe_get_state());
+
+    CHECK(!sim_output_contains("hook chain error"));
+}
+
+static stepper_pulse_start_ptr foreign_next;
+static uint32_t foreign_calls;
+
+static void foreign_pulse_start (stepper_t *stepper)
+{
+    foreign_calls++;
+    foreign_next(stepper);
+}
+
+// A hook stacked on top by another plugin is left in place on disconnect and no hook is installed twice,
+// every step event reaches the driver exactly once.
+static void test_hook_stacked (void)
+{
+    setup();
+
+    CHECK(sim_line("M401") == Status_OK);
+
+    foreign_next = hal.stepper.pulse_start;
+    hal.stepper.pulse_start = foreign_pulse_start;
+
+    CHECK(sim_line("M402") == Status_OK);
+    CHECK(hal.stepper.pulse_start == foreign_pulse_start);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(hal.stepper.pulse_start == foreign_pulse_start);
+
+    sim_clear_stats();
+    CHECK(sim_line("G0X10") == Status_OK);
+    CHECK(sim.stats.pulses == 2000);
+    CHECK(foreign_calls == sim.stats.pulses);
+
+    // still protected through the foreign hook.
+    floor_at(-5.0f);
+    sim_line("G0Z-10");
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+}
+
+// Contact during a rapid with the probe connected resets the controller, motion stops within the latency.
+static void test_trip_rapid (void)
+{
+    setup();
+
+    sim.latency = 1.0f;
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+
+    sim_clear_stats();
+    CHECK(sim_line("G0Z-10") == Status_Unhandled);
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+    CHECK(sim.stats.resets == 1);
+    CHECK(sim.stats.position_lost);
+    CHECK(events.tripped == 1);
+    CHECK(sim.stats.penetration <= sim.stats.contact_rate / 60.0f * sim.latency / 1000.0f + 2.0f * STEP);
+
+    // protection survives the reset.
+    CHECK(pulse_hooked());
+}
+
+// A disconnected probe stops any motion while protection is armed.
+static void test_trip_disconnected (void)
+{
+    setup();
+
+    CHECK(sim_line("M401") == Status_OK);
+
+    sim.probe_connected = false;
+    sim_line("G0X5");
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+    CHECK(sim.stats.position_lost);
+}
+
+// Protection is off during the probe cycle and armed again when it completes.
+static void test_probe_cycle (void)
+{
+    setup();
+
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F100") == Status_OK);
+    CHECK(!sim_output_contains("PROBE PROTECTED!"));
+    CHECK(events.completed == 1);
+    CHECK(fabsf((float)sys.probe_position[Z_AXIS] / 200.0f + 5.0f) <= 2.0f * STEP);
+    CHECK(pulse_hooked());
+
+    // released before retracting.
+    CHECK(sim_line("G91G38.4Z1F100") == Status_OK);
+    CHECK(sim_line("G90G0Z0") == Status_OK);
+    CHECK(!sim_output_contains("PROBE PROTECTED!"));
+    CHECK(fabsf(position_z()) <= STEP);
+    CHECK(!sim_output_contains("hook chain error"));
+}
+
+// A rapid retract straight after contact trips protection since the stylus is still deflected.
+static void test_retract_deflected (void)
+{
+    setup();
+
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F100") == Status_OK);
+    sim_line("G0Z0");
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+}
+
+// The probing feed rate is limited so the machine stops within the stylus overtravel.
+static void test_overtravel (void)
+{
+    setup();
+
+    sim.latency = 2.0f;
+    floor_at(-5.0f);
+
+    CHECK(sim_setting(Setting_UserDefined_2, "2"));
+
+    // unlimited for reference.
+    sim_clear_stats();
+    CHECK(sim_line("G38.2Z-10F1000") == Status_OK);
+    CHECK(sim.stats.probe_feed_rate == 1000.0f);
+    CHECK(sim.stats.penetration > 0.25f);
+    CHECK(sim_line("G0Z0") == Status_OK);
+
+    CHECK(sim_setting(Setting_UserDefined_3, "0.2"));
+
+    sim_clear_stats();
+    sim_output_clear();
+    CHECK(sim_line("G38.2Z-10F1000") == Status_OK);
+    CHECK(sim_output_contains("Probe feed rate limited by stylus overtravel"));
+    CHECK(sim.stats.probe_feed_rate < 800.0f && sim.stats.probe_feed_rate > 780.0f);
+    CHECK(sim.stats.penetration <= 0.2f + STEP);
+
+    // reported once until the settings are changed.
+    CHECK(sim_line("G0Z0") == Status_OK);
+    sim_output_clear();
+    CHECK(sim_line("G38.2Z-10F1000") == Status_OK);
+    CHECK(sim.stats.probe_feed_rate < 800.0f);
+    CHECK(!sim_output_contains("Probe feed rate limited by stylus overtravel"));
+
+    // slower feed rates are not changed.
+    CHECK(sim_line("G0Z0") == Status_OK);
+    sim_clear_stats();
+    CHECK(sim_line("G38.2Z-10F300") == Status_OK);
+    CHECK(sim.stats.probe_feed_rate == 300.0f);
+
+    // nor are toolsetter feed rates.
+    CHECK(sim_line("G0Z0") == Status_OK);
+    CHECK(sim_setting(Setting_UserDefined_3, "0.2"));
+    sim.tool_change = true;
+    sim_output_clear();
+    CHECK(sim_line("T1") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F1000") == Status_OK);
+    CHECK(sim.stats.probe_feed_rate == 1000.0f);
+    CHECK(!sim_output_contains("Probe feed rate limited by stylus overtravel"));
+}
+
+// The toolsetter on its own input is read in place of the probe input during tool change probing only.
+static void test_toolsetter_redirect (void)
+{
+    setup();
+
+    CHECK(sim_setting(Setting_UserDefined_9, "16")); // alternate tool probe pin
+    sim_settings_reload();
+
+    sim.toolsetter_aux = true;
+    sim.toolsetter_port = 0;
+    sim_surface_set(&sim.toolsetter, 0.0f, 0.0f, -20.0f, 0.0f, 0.0f, 1.0f);
+    floor_at(-5.0f); // a probe input contact is ignored
+
+    sim.tool_change = true;
+    CHECK(sim_line("T1") == Status_OK);
+    CHECK(sim_line("G38.2Z-30F100") == Status_OK);
+    CHECK(events.completed == 1 && events.redirected);
+    CHECK(fabsf((float)sys.probe_position[Z_AXIS] / 200.0f + 20.0f) <= 2.0f * STEP);
+    CHECK(hal.probe.get_state == sim_driver_probe_get_state());
+
+    // not redirected outside tool change probing.
+    sim.tool_change = false;
+    CHECK(sim_line("G0Z0") == Status_OK);
+    CHECK(sim_line("G38.2Z-30F100") == Status_OK);
+    CHECK(events.completed == 2 && !events.redirected);
+    CHECK(fabsf((float)sys.probe_position[Z_AXIS] / 200.0f + 5.0f) <= 2.0f * STEP);
+    CHECK(!sim_output_contains("hook chain error"));
+}
+
+// M403 words are kept for execution after validation has cleared them, P selects the offset written.
+static void test_mcode_words (void)
+{
+    float g54[N_AXIS], g55[N_AXIS];
+
+    setup();
+
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M403P2K1") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F100") == Status_OK);
+    CHECK(sim_output_contains("Work offset G55 updated"));
+    CHECK(settings_read_coord_data(CoordinateSystem_G54, &g54) && g54[Z_AXIS] == 0.0f);
+    CHECK(settings_read_coord_data(CoordinateSystem_G55, &g55) && fabsf(g55[Z_AXIS] + 6.0f) <= 2.0f * STEP);
+}
+
+// The quick check approaches the last contact of a measured tool at the seek rate, a longer tool trips protection.
+static void test_tool_check_approach (void)
+{
+    setup();
+
+    CHECK(sim_setting(Setting_UserDefined_6, "8")); // quick check measured tools
+    sim_settings_reload();
+    sim_surface_set(&sim.toolsetter, 0.0f, 0.0f, -20.0f, 0.0f, 0.0f, 1.0f);
+
+    sim.tool_change = true;
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("T1") == Status_OK);
+    CHECK(sim_line("G38.2Z-30F100") == Status_OK);
+    CHECK(sim_line("G91G38.4Z1F50") == Status_OK);
+    CHECK(sim_line("G90G0Z0") == Status_OK);
+
+    // 8 mm longer, touches within the approach to the 5 mm standoff.
+    sim_surface_set(&sim.toolsetter, 0.0f, 0.0f, -12.0f, 0.0f, 0.0f, 1.0f);
+    sim_clear_stats();
+    sim_line("G38.2Z-30F100");
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+    CHECK(sim.stats.contact_rate > 100.0f && sim.stats.contact_rate <= settings.tool_change.seek_rate + 1.0f);
+}
+
+// Scanning captures contacts during feed moves without stopping them, a rapid into the surface still trips.
+static void test_scan_rapid (void)
+{
+    setup();
+
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("M404P1") == Status_OK);
+    CHECK(sim_line("G1Z-5.1F100") == Status_OK);
+    CHECK(sim_line("G1Z-4F100") == Status_OK);
+    CHECK(!sim_output_contains("PROBE PROTECTED!"));
+    CHECK(fabsf(position_z() + 4.0f) <= STEP);
+
+    sim_line("G0Z-6");
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+    CHECK(events.tripped == 1);
+}
+
+// M405 approaches a remembered contact at the feed rate limited by the stylus overtravel, not with a rapid.
+static void test_predictive_approach (void)
+{
+    setup();
+
+    sim.latency = 2.0f;
+    floor_at(-5.0f);
+
+    CHECK(sim_setting(Setting_UserDefined_2, "2"));
+    CHECK(sim_setting(Setting_UserDefined_4, "2"));
+    CHECK(sim_line("M401") == Status_OK);
+
+    CHECK(sim_line("M405P1") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F100") == Status_OK);
+    CHECK(sim_line("G91G38.4Z1F50") == Status_OK);
+    CHECK(sim_line("G90G0Z0") == Status_OK);
+
+    // no approach without an overtravel setting.
+    sim_clear_stats();
+    CHECK(sim_line("M405P1") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F100") == Status_OK);
+    CHECK(sim.stats.contact_rate <= 100.0f);
+    CHECK(sim_line("G91G38.4Z1F50") == Status_OK);
+    CHECK(sim_line("G90G0Z0") == Status_OK);
+
+    CHECK(sim_setting(Setting_UserDefined_3, "0.5"));
+
+    // a part higher than remembered is hit during the approach.
+    floor_at(-2.5f);
+    sim_clear_stats();
+    CHECK(sim_line("M405P1") == Status_OK);
+    sim_line("G38.2Z-10F100");
+    CHECK(sim_output_contains("PROBE PROTECTED!"));
+    CHECK(sim.stats.contact_rate > 100.0f && sim.stats.contact_rate < 1300.0f);
+    CHECK(sim.stats.penetration <= 0.5f);
+}
+
+// Runs the recording in a new process and returns the $PROBETRACE dump, the replay starts the plugin from power up.
+static char *record_trace (void (*recording)(void))
+{
+    int fd[2];
+    pid_t pid;
+    size_t len = 0;
+    ssize_t n;
+    char *log = malloc(16384);
+    int status;
+
+    CHECK(log && pipe(fd) == 0);
+
+    if((pid = fork()) == 0) {
+        close(fd[0]);
+        recording();
+        sim_output_clear();
+        CHECK(sim_line("$PROBETRACE") == Status_OK);
+        CHECK(write(fd[1], sim_output(), strlen(sim_output())) == (ssize_t)strlen(sim_output()));
+        exit(0);
+    }
+
+    close(fd[1]);
+    while(len < 16383 && (n = read(fd[0], log + len, 16383 - len)) > 0)
+        len += n;
+    log[len] = '\0';
+    close(fd[0]);
+
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    return log;
+}
+
+static void replay_trace (const char *log, float latency)
+{
+    char *lines = strdup(log), *line, *save;
+
+    replay_init(latency, verbose);
+    for(line = strtok_r(lines, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save))
+        CHECK(replay_line(line));
+    replay_end();
+
+    free(lines);
+}
+
+static void replay_recording (void)
+{
+    setup();
+
+    sim.latency = 1.0f;
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("G38.2Z-10F100") == Status_OK);
+    CHECK(sim_line("G91G38.4Z1F50") == Status_OK);
+    CHECK(sim_line("G90G0Z0") == Status_OK);
+    CHECK(sim_line("T2") == Status_OK);
+    CHECK(sim_line("G0X20") == Status_OK);
+    CHECK(sim_line("G38.3Z-4F200") == Status_OK); // no contact
+    CHECK(sim_line("G0Z0") == Status_OK);
+    sim_line("G0Z-10");
+    CHECK(events.tripped == 1);
+    CHECK(sim_line("$X") == Status_OK);
+    CHECK(sim_line("M402") == Status_OK);
+}
+
+// The feed rate tuner puts back the motion mode and feed rate changed by its lines.
+static void test_tune_modal (void)
+{
+    setup();
+
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("G1Z-1F123") == Status_OK);
+    CHECK(sim_line("M406K-10Q300L2") == Status_OK);
+    CHECK(sim_output_contains("Probe tune: fastest feed rate"));
+    CHECK(gc_state.modal.motion == MotionMode_Linear);
+    CHECK(gc_state.feed_rate == 123.0f);
+    CHECK(!gc_state.modal.distance_incremental);
+    CHECK(sim_line("M402") == Status_OK);
+}
+
+// Toolsetter side facing a 6 mm tool, the -X side until the first touch and its release have completed.
+// Surfaces are touched by the tool center, set back by the tool radius.
+static void toolsetter_side (uint32_t completed)
+{
+    if(completed == 2)
+        sim_surface_set(&sim.toolsetter, 8.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+}
+
+// The tool diameter measurement puts back the motion mode and feed rate changed by its lines.
+static void test_tooldia_modal (void)
+{
+    static const float g59_3[N_AXIS] = {0};
+    float diameter;
+
+    setup();
+
+    CHECK(sim_setting(Setting_UserDefined_0, "10")); // toolsetter diameter
+    sim_coord_set(CoordinateSystem_G59_3, g59_3);
+    sim_surface_set(&sim.toolsetter, -8.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f);
+    events.on_completed = toolsetter_side;
+
+    CHECK(sim_line("G1F123") == Status_OK);
+    CHECK(sim_line("M407D6P0") == Status_OK);
+    CHECK(sscanf(strstr(sim_output(), "[TOOLDIA:") ?: "", "[TOOLDIA:0,%f", &diameter) == 1);
+    CHECK(fabsf(diameter - 6.0f) <= 4.0f * STEP);
+    CHECK(gc_state.modal.motion == MotionMode_Linear);
+    CHECK(gc_state.feed_rate == 123.0f);
+    CHECK(!gc_state.modal.distance_incremental);
+}
+
+// A grid probed with protection armed backs off each contact before the retract rapid and
+// puts back the motion mode and feed rate.
+static void test_grid_release (void)
+{
+    float a, b, c;
+
+    setup();
+
+    floor_at(-5.0f);
+
+    CHECK(sim_line("M401") == Status_OK);
+    CHECK(sim_line("G1F123") == Status_OK);
+    CHECK(sim_line("M411I10J10P3Q2K10") == Status_OK);
+    CHECK(!sim_output_contains("PROBE PROTECTED!") && events.tripped == 0);
+    CHECK(sscanf(strstr(sim_output(), "[GRID:") ?: "", "[GRID:%f,%f,%f", &a, &b, &c) == 3);
+    CHECK(fabsf(a) < 0.001f && fabsf(b) < 0.001f && fabsf(c + 5.0f) <= 2.0f * STEP);
+    CHECK(gc_state.modal.motion == MotionMode_Linear);
+    CHECK(gc_state.feed_rate == 123.0f);
+    CHECK(!gc_state.modal.distance_incremental);
+    CHECK(fabsf(position_z()) <= STEP);
+    CHECK(sim_line("M402") == Status_OK);
+}
+
+// Pseudo random residual in -1..1, repeatable between runs.
+static float noise (uint32_t *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+
+    return (float)((*seed >> 8) & 0xFFFF) / 32767.5f - 1.0f;
+}
+
+// Circle far from the origin with radial residuals, the rms expanded from the sums matches the one of the points.
+static void test_fit_circle (void)
+{
+    uint32_t idx, seed = 1;
+    float x[24], y[24], residual, ssr = 0.0f;
+    probe_fit_t fit;
+    probe_fit_result_t result;
+
+    probe_fit_init(&fit, ProbeFit_Circle);
+    for(idx = 0; idx < 24; idx++) {
+        float angle = (float)idx * 2.0f * (float)M_PI / 24.0f, radius = 10.0f + 0.01f * noise(&seed);
+        x[idx] = 500.0f + radius * cosf(angle);
+        y[idx] = -300.0f + radius * sinf(angle);
+        probe_fit_add(&fit, x[idx], y[idx], 0.0f);
+    }
+
+    CHECK(probe_fit_solve(&fit, &result) && result.n == 24);
+    CHECK(fabsf(result.value[0] - 500.0f) < 0.005f && fabsf(result.value[1] + 300.0f) < 0.005f && fabsf(result.value[2] - 10.0f) < 0.005f);
+
+    for(idx = 0; idx < 24; idx++) {
+        residual = hypotf(x[idx] - result.value[0], y[idx] - result.value[1]) - result.value[2];
+        ssr += residual * residual;
+    }
+    CHECK(result.rms > 0.001f && fabsf(result.rms - sqrtf(ssr / 24.0f)) < 0.0005f);
+
+    // exact points, no residual.
+    probe_fit_init(&fit, ProbeFit_Circle);
+    probe_fit_add(&fit, 5.0f, 0.0f, 0.0f);
+    probe_fit_add(&fit, 0.0f, 5.0f, 0.0f);
+    probe_fit_add(&fit, -5.0f, 0.0f, 0.0f);
+    CHECK(probe_fit_solve(&fit, &result));
+    CHECK(fabsf(result.value[2] - 5.0f) < 0.0001f && result.rms < 0.0001f);
+}
+
+// Tilted plane with z residuals, the rms expanded from the sums matches the one of the points.
+static void test_fit_plane (void)
+{
+    uint32_t idx, seed = 2;
+    float x, y, z[25], residual, ssr = 0.0f;
+    probe_fit_t fit;
+    probe_fit_result_t result;
+
+    probe_fit_init(&fit, ProbeFit_Plane);
+    for(idx = 0; idx < 25; idx++) {
+        x = 100.0f + (float)(idx % 5) * 20.0f;
+        y = 200.0f + (float)(idx / 5) * 20.0f;
+        z[idx] = 0.001f * x - 0.002f * y - 40.0f + 0.005f * noise(&seed);
+        probe_fit_add(&fit, x, y, z[idx]);
+    }
+
+    CHECK(probe_fit_solve(&fit, &result));
+    CHECK(fabsf(result.value[0] - 0.001f) < 0.0002f && fabsf(result.value[1] + 0.002f) < 0.0002f && fabsf(result.value[2] + 40.0f) < 0.05f);
+
+    for(idx = 0; idx < 25; idx++) {
+        x = 100.0f + (float)(idx % 5) * 20.0f;
+        y = 200.0f + (float)(idx / 5) * 20.0f;
+        residual = z[idx] - (result.value[0] * x + result.value[1] * y + result.value[2]);
+        ssr += residual * residual;
+    }
+    CHECK(result.rms > 0.001f && fabsf(result.rms - sqrtf(ssr / 25.0f)) < 0.0002f);
+}
+
+// Line at 30 degrees with normal residuals, the rms is the normal distance of the points.
+static void test_fit_line (void)
+{
+    uint32_t idx;
+    float offset;
+    probe_fit_t fit;
+    probe_fit_result_t result;
+
+    probe_fit_init(&fit, ProbeFit_Line);
+    for(idx = 0; idx < 10; idx++) {
+        offset = idx & 1 ? 0.01f : -0.01f;
+        probe_fit_add(&fit, 50.0f + (float)idx * cosf((float)M_PI / 6.0f) - offset * sinf((float)M_PI / 6.0f),
+                             20.0f + (float)idx * sinf((float)M_PI / 6.0f) + offset * cosf((float)M_PI / 6.0f), 0.0f);
+    }
+
+    CHECK(probe_fit_solve(&fit, &result));
+    CHECK(fabsf(result.value[2] - 30.0f) < 0.05f);
+    CHECK(fabsf(result.rms - 0.01f) < 0.0005f);
+
+    probe_fit_init(&fit, ProbeFit_Line);
+    probe_fit_add(&fit, 1.0f, 1.0f, 0.0f);
+    probe_fit_add(&fit, 1.0f, 1.0f, 0.0f);
+    CHECK(!probe_fit_solve(&fit, &result)); // coincident
+}
+
+// Collinear and coincident points are rejected by the Cramer's rule tolerance, a small but
+// well conditioned triangle far from the origin is not.
+static void test_fit_degenerate (void)
+{
+    probe_fit_t fit;
+    probe_fit_result_t result;
+
+    probe_fit_init(&fit, ProbeFit_Circle);
+    probe_fit_add(&fit, 0.0f, 0.0f, 0.0f);
+    probe_fit_add(&fit, 10.0f, 0.0f, 0.0f);
+    CHECK(!probe_fit_solve(&fit, &result)); // too few
+
+    probe_fit_add(&fit, 20.0f, 0.0f, 0.0f);
+    CHECK(!probe_fit_solve(&fit, &result)); // collinear
+
+    probe_fit_init(&fit, ProbeFit_Plane);
+    probe_fit_add(&fit, 1000.0f, 1000.0f, 1.0f);
+    probe_fit_add(&fit, 1010.0f, 1010.0f, 2.0f);
+    probe_fit_add(&fit, 1020.0f, 1020.0f, 3.0f);
+    probe_fit_add(&fit, 1030.0f, 1030.001f, 4.0f); // off the line by less than the tolerance
+    CHECK(!probe_fit_solve(&fit, &result));
+
+    probe_fit_init(&fit, ProbeFit_Plane);
+    probe_fit_add(&fit, 5.0f, 5.0f, 0.0f);
+    probe_fit_add(&fit, 5.0f, 5.0f, 0.0f);
+    probe_fit_add(&fit, 5.0f, 5.0f, 0.0f);
+    CHECK(!probe_fit_solve(&fit, &result)); // coincident
+
+    probe_fit_init(&fit, ProbeFit_Plane);
+    probe_fit_add(&fit, 1000.0f, 1000.0f, 1.0f);
+    probe_fit_add(&fit, 1001.0f, 1000.0f, 1.0f);
+    probe_fit_add(&fit, 1000.0f, 1001.0f, 2.0f);
+    CHECK(probe_fit_solve(&fit, &result));
+    CHECK(fabsf(result.value[0]) < 0.001f && fabsf(result.value[1] - 1.0f) < 0.001f && result.rms < 0.0001f);
+}
+
+// A trace recorded by the plugin replays to the same triggers and protection trips.
+static void test_replay (void)
+{
+    replay_stats_t *stats;
+    char *log = record_trace(replay_recording);
+
+    sim.echo = verbose;
+    replay_trace(log, 1.0f);
+
+    stats = replay_stats();
+    CHECK(replay_matched());
+    CHECK(stats->malformed == 0);
+    CHECK(stats->cycles == 3 && stats->incomplete == 0);
+    CHECK(stats->triggered == 2 && stats->sim_triggered == 2 && stats->mismatches == 0);
+    CHECK(stats->trigger_error <= 2.0f * STEP);
+    CHECK(stats->trips == 1 && stats->sim_trips == 1);
+    CHECK(stats->resets == 1 && sim.stats.resets == 1);
+    CHECK(sim.stats.hooked_pulses > 0);
+}
+
+// Without the recorded M401 protection is not armed in the replay and the recorded trip is not reproduced.
+static void test_replay_mismatch (void)
+{
+    char *log = record_trace(replay_recording);
+
+    *strstr(log, "[PRBTRC:05") = '-';
+
+    sim.echo = verbose;
+    replay_trace(log, 1.0f);
+
+    CHECK(!replay_matched());
+    CHECK(replay_stats()->trips == 1 && replay_stats()->sim_trips == 0);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} test_t;
+
+static const test_t tests[] = {
+    { "hook_restore", test_hook_restore },
+    { "hook_stacked", test_hook_stacked },
+    { "trip_rapid", test_trip_rapid },
+    { "trip_disconnected", test_trip_disconnected },
+    { "probe_cycle", test_probe_cycle },
+    { "retract_deflected", test_retract_deflected },
+    { "overtravel", test_overtravel },
+    { "toolsetter_redirect", test_toolsetter_redirect },
+    { "mcode_words", test_mcode_words },
+    { "tool_check_approach", test_tool_check_approach },
+    { "scan_rapid", test_scan_rapid },
+    { "predictive_approach", test_predictive_approach },
+    { "tune_modal", test_tune_modal },
+    { "tooldia_modal", test_tooldia_modal },
+    { "grid_release", test_grid_release },
+    { "fit_circle", test_fit_circle },
+    { "fit_plane", test_fit_plane },
+    { "fit_line", test_fit_line },
+    { "fit_degenerate", test_fit_degenerate },
+    { "replay", test_replay },
+    { "replay_mismatch", test_replay_mismatch },
+};
+
+int main (int argc, char **argv)
+{
+    int idx, status, failed = 0, run = 0;
+    const char *only = NULL;
+
+    for(idx = 1; idx < argc; idx++) {
+        if(!strcmp(argv[idx], "-v"))
+            verbose = true;
+        else
+            only = argv[idx];
+    }
+
+    for(idx = 0; idx < (int)(sizeof(tests) / sizeof(test_t)); idx++) {
+
+        pid_t pid;
+
+        if(only && strcmp(only, tests[idx].name))
+            continue;
+
+        fflush(stdout);
+
+        if((pid = fork()) == 0) {
+            tests[idx].run();
+            exit(0);
+        }
+
+        waitpid(pid, &status, 0);
+        run++;
+
+        if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            printf("PASS %s\n", tests[idx].name);
+        else {
+            printf("FAIL %s\n", tests[idx].name);
+            failed++;
+        }
+    }
+
+    printf("%d of %d tests passed\n", run - failed, run);
+
+    return failed ? 1 : 0;
+}